@@ -0,0 +1,360 @@
+/****************************************************************************
+ *
+ * hpc-prof.h - Lightweight profiler for nested named regions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * --------------------------------------------------------------------------
+ *
+ * If the symbol HPC_PROF is defined (e.g., by compiling with
+ * -DHPC_PROF, or with "make PROF=1"), this header provides a profiler
+ * for nested named regions:
+ *
+ *      HPC_PROF_INIT();
+ *      ...
+ *      HPC_PROF_BEGIN("compute_forces");
+ *      ...
+ *      HPC_PROF_END();
+ *
+ * It must be included after hpc.h, since timestamps are calibrated
+ * against hpc_gettime().
+ *
+ * Regions can be nested, and can be used inside OpenMP parallel
+ * regions: each thread records its own events in a private buffer.
+ * Buffers are indexed by omp_get_thread_num(), that is unique only
+ * within one team; therefore, regions must not be opened inside
+ * nested parallel regions (this is checked with an assertion).
+ *
+ * Timestamps are taken from the CPU cycle counter (TSC on x86-64,
+ * virtual counter on ARM64), calibrated against hpc_gettime() by
+ * spinning for about 20 ms; other architectures use hpc_gettime()
+ * directly. The calibration is done by HPC_PROF_INIT(), that should
+ * be called once before any timed section of the program (calling it
+ * again does nothing); if it is not called, the first
+ * HPC_PROF_BEGIN() does the calibration, and the 20 ms are charged
+ * to whatever is being timed at that moment.
+ *
+ * At program exit (or when HPC_PROF_DUMP() is called) two files are
+ * written:
+ *
+ * - PREFIX.json: all events in Chrome trace-event format (open it
+ *   with chrome://tracing or https://ui.perfetto.dev);
+ *
+ * - PREFIX.csv: per-region summary (calls, total/min/max time).
+ *
+ * PREFIX is "hpc-prof" unless the environment variable HPC_PROF_OUT
+ * says otherwise; under MPI, the rank (taken from the environment
+ * variables set by the launcher) is appended, so that each process
+ * writes its own files.
+ *
+ * If HPC_PROF is not defined, all the HPC_PROF_xxx() macros expand to
+ * nothing and have no cost at all.
+ *
+ ****************************************************************************/
+
+#ifndef HPC_PROF_H
+#define HPC_PROF_H
+
+#ifdef HPC_PROF
+/******************************************************************************
+ * Profiler
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#define HPC_PROF_MAX_THREADS 256   /* maximum number of threads */
+#define HPC_PROF_MAX_EVENTS 65536  /* maximum number of events per thread */
+#define HPC_PROF_MAX_DEPTH 64      /* maximum nesting level */
+#define HPC_PROF_MAX_REGIONS 256   /* maximum number of distinct regions in the summary */
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+static unsigned long long hpc_prof_ticks( void ) { return __rdtsc(); }
+#define HPC_PROF_HAS_COUNTER 1
+#elif defined(__aarch64__)
+static unsigned long long hpc_prof_ticks( void )
+{
+    unsigned long long t;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+}
+#define HPC_PROF_HAS_COUNTER 1
+#else
+static unsigned long long hpc_prof_ticks( void ) { return (unsigned long long)(hpc_gettime() * 1e9); }
+#define HPC_PROF_HAS_COUNTER 0
+#endif
+
+typedef struct {
+    const char *name;
+    unsigned long long begin, end; /* ticks */
+    int depth;
+} hpc_prof_event_t;
+
+typedef struct {
+    hpc_prof_event_t *events;
+    int nevents;
+    int ndropped;
+    int depth;
+    const char *name[HPC_PROF_MAX_DEPTH];
+    unsigned long long begin[HPC_PROF_MAX_DEPTH];
+} hpc_prof_thread_t;
+
+/* Summary of all events with the same name and nesting level */
+typedef struct {
+    const char *name;
+    int depth;
+    int nthreads;
+    int last_thread;
+    long calls;
+    double total, tmin, tmax;
+} hpc_prof_stat_t;
+
+static hpc_prof_thread_t *hpc_prof_threads[HPC_PROF_MAX_THREADS];
+static unsigned long long hpc_prof_t0;     /* ticks at initialization */
+static double hpc_prof_sec_per_tick = 1e-9;
+static int hpc_prof_initialized = 0;       /* read and written atomically */
+
+void hpc_prof_dump( void );
+
+/* Estimate the duration of a tick by comparing the counter with
+   hpc_gettime() over (at least) 20 ms; only the first call has any
+   effect. The flag is set with sequentially consistent atomics, so
+   that a thread that sees it set also sees the calibration. */
+void hpc_prof_init( void )
+{
+    int done;
+#if defined(_OPENMP)
+#pragma omp atomic read seq_cst
+#endif
+    done = hpc_prof_initialized;
+    if (done) {
+        return;
+    }
+#if defined(_OPENMP)
+#pragma omp critical(hpc_prof)
+#endif
+    if (!hpc_prof_initialized) {
+#if HPC_PROF_HAS_COUNTER
+        const double tstart = hpc_gettime();
+        const unsigned long long c0 = hpc_prof_ticks();
+        double t;
+        do {
+            t = hpc_gettime();
+        } while (t - tstart < 0.02);
+        hpc_prof_sec_per_tick = (t - tstart) / (double)(hpc_prof_ticks() - c0);
+#endif
+        hpc_prof_t0 = hpc_prof_ticks();
+        atexit(hpc_prof_dump);
+#if defined(_OPENMP)
+#pragma omp atomic write seq_cst
+#endif
+        hpc_prof_initialized = 1;
+    }
+}
+
+static int hpc_prof_thread_id( void )
+{
+#if defined(_OPENMP)
+    /* thread numbers are not unique across nested teams */
+    assert(omp_get_active_level() <= 1);
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+static hpc_prof_thread_t *hpc_prof_self( void )
+{
+    const int tid = hpc_prof_thread_id();
+    assert(tid < HPC_PROF_MAX_THREADS);
+    hpc_prof_init();
+    /* each thread allocates its own buffer, so no locking is needed */
+    if (hpc_prof_threads[tid] == NULL) {
+        hpc_prof_thread_t *th = (hpc_prof_thread_t*)calloc(1, sizeof(*th));
+        assert(th != NULL);
+        th->events = (hpc_prof_event_t*)malloc(HPC_PROF_MAX_EVENTS * sizeof(*th->events));
+        assert(th->events != NULL);
+        hpc_prof_threads[tid] = th;
+    }
+    return hpc_prof_threads[tid];
+}
+
+/* Open region `name`; `name` must be a string literal (or otherwise
+   stay valid until the end of the program) */
+void hpc_prof_begin( const char *name )
+{
+    hpc_prof_thread_t *th = hpc_prof_self();
+    assert(th->depth < HPC_PROF_MAX_DEPTH);
+    th->name[th->depth] = name;
+    th->begin[th->depth] = hpc_prof_ticks();
+    th->depth++;
+}
+
+/* Close the innermost open region of the calling thread */
+void hpc_prof_end( void )
+{
+    const unsigned long long now = hpc_prof_ticks();
+    hpc_prof_thread_t *th = hpc_prof_self();
+    assert(th->depth > 0);
+    th->depth--;
+    if (th->nevents < HPC_PROF_MAX_EVENTS) {
+        hpc_prof_event_t *ev = &th->events[th->nevents++];
+        ev->name = th->name[th->depth];
+        ev->begin = th->begin[th->depth];
+        ev->end = now;
+        ev->depth = th->depth;
+    } else {
+        th->ndropped++;
+    }
+}
+
+/* Rank of this process under mpirun/srun, or -1 if not available */
+static int hpc_prof_rank( void )
+{
+    const char *vars[] = {"OMPI_COMM_WORLD_RANK", "PMI_RANK", "PMIX_RANK", "SLURM_PROCID"};
+    for (int i=0; i<(int)(sizeof(vars)/sizeof(vars[0])); i++) {
+        const char *v = getenv(vars[i]);
+        if (v != NULL) {
+            return atoi(v);
+        }
+    }
+    return -1;
+}
+
+/* Write the trace and the summary; can be called more than once, and
+   is called automatically at exit */
+void hpc_prof_dump( void )
+{
+    char fname[1024];
+    const char *prefix = getenv("HPC_PROF_OUT");
+    const int rank = hpc_prof_rank();
+    const int pid = (rank >= 0 ? rank : 0);
+    FILE *f;
+
+    if (!hpc_prof_initialized) {
+        return;
+    }
+    if (prefix == NULL) {
+        prefix = "hpc-prof";
+    }
+
+    /* Chrome trace: one complete ("X") event per region; time stamps
+       and durations are in microseconds */
+    if (rank >= 0) {
+        snprintf(fname, sizeof(fname), "%s.%d.json", prefix, rank);
+    } else {
+        snprintf(fname, sizeof(fname), "%s.json", prefix);
+    }
+    f = fopen(fname, "w");
+    if (f == NULL) {
+        fprintf(stderr, "hpc_prof_dump(): can not create %s\n", fname);
+        return;
+    }
+    fprintf(f, "{\"traceEvents\":[\n");
+    int first = 1;
+    for (int t=0; t<HPC_PROF_MAX_THREADS; t++) {
+        const hpc_prof_thread_t *th = hpc_prof_threads[t];
+        if (th == NULL) {
+            continue;
+        }
+        for (int i=0; i<th->nevents; i++) {
+            const hpc_prof_event_t *ev = &th->events[i];
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    first ? "" : ",\n", ev->name,
+                    1e6 * (double)(ev->begin - hpc_prof_t0) * hpc_prof_sec_per_tick,
+                    1e6 * (double)(ev->end - ev->begin) * hpc_prof_sec_per_tick,
+                    pid, t);
+            first = 0;
+        }
+        if (th->ndropped > 0) {
+            fprintf(stderr, "hpc_prof_dump(): thread %d dropped %d events\n", t, th->ndropped);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    /* Summary: regions are identified by name and nesting level, and
+       aggregated over all threads */
+    if (rank >= 0) {
+        snprintf(fname, sizeof(fname), "%s.%d.csv", prefix, rank);
+    } else {
+        snprintf(fname, sizeof(fname), "%s.csv", prefix);
+    }
+    f = fopen(fname, "w");
+    if (f == NULL) {
+        fprintf(stderr, "hpc_prof_dump(): can not create %s\n", fname);
+        return;
+    }
+    fprintf(f, "region,depth,threads,calls,total,avg,min,max\n");
+    hpc_prof_stat_t *stats = (hpc_prof_stat_t*)calloc(HPC_PROF_MAX_REGIONS, sizeof(*stats));
+    int nstats = 0;
+    assert(stats != NULL);
+    for (int t=0; t<HPC_PROF_MAX_THREADS; t++) {
+        const hpc_prof_thread_t *th = hpc_prof_threads[t];
+        for (int i=0; th != NULL && i<th->nevents; i++) {
+            const hpc_prof_event_t *ev = &th->events[i];
+            const double d = (double)(ev->end - ev->begin) * hpc_prof_sec_per_tick;
+            int k = 0;
+            while (k < nstats && !(stats[k].depth == ev->depth && 0 == strcmp(stats[k].name, ev->name))) {
+                k++;
+            }
+            if (k == nstats) {
+                if (nstats == HPC_PROF_MAX_REGIONS) {
+                    continue;
+                }
+                stats[k].name = ev->name;
+                stats[k].depth = ev->depth;
+                stats[k].tmin = d;
+                stats[k].last_thread = -1;
+                nstats++;
+            }
+            stats[k].calls++;
+            stats[k].total += d;
+            stats[k].tmin = (d < stats[k].tmin ? d : stats[k].tmin);
+            stats[k].tmax = (d > stats[k].tmax ? d : stats[k].tmax);
+            if (stats[k].last_thread != t) {
+                stats[k].nthreads++;
+                stats[k].last_thread = t;
+            }
+        }
+    }
+    for (int k=0; k<nstats; k++) {
+        fprintf(f, "%s,%d,%d,%ld,%e,%e,%e,%e\n", stats[k].name, stats[k].depth,
+                stats[k].nthreads, stats[k].calls, stats[k].total,
+                stats[k].total / stats[k].calls, stats[k].tmin, stats[k].tmax);
+    }
+    free(stats);
+    fclose(f);
+}
+
+#define HPC_PROF_INIT() hpc_prof_init()
+#define HPC_PROF_BEGIN(name) hpc_prof_begin(name)
+#define HPC_PROF_END() hpc_prof_end()
+#define HPC_PROF_DUMP() hpc_prof_dump()
+
+#else
+
+#define HPC_PROF_INIT() ((void)0)
+#define HPC_PROF_BEGIN(name) ((void)0)
+#define HPC_PROF_END() ((void)0)
+#define HPC_PROF_DUMP() ((void)0)
+
+#endif
+
+
+#endif
@@ -46,11 +46,13 @@
 #endif
 
 #include "hpc.h"
+#include "hpc-prof.h"
 #include <mpi.h>
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -117,6 +119,154 @@ MPI_Datatype particletype; // MPI_Datatype for particle_t struct
 int *sendcounts = NULL;
 int *displs = NULL;
 
+/* Cost-weighted partitioning of the particles among processes.
+
+   Each process examines all particles for each of its own, but only
+   the neighbors within distance H (whose number ranges from 0 for a
+   splashing particle to about 30 in the compressed bottom layer) go
+   through the expensive part of the loops. Equal blocks of particles
+   therefore take different times, and the processes wait for the
+   slowest one at each MPI_Allgatherv(). compute_density_pressure()
+   counts the neighbors of each particle. The counts are gathered by
+   all processes, and at the end of each step balance_partition()
+   recomputes sendcounts[] and displs[] for the next step so that each
+   block has about the same estimated cost
+
+        n_particles + INTERACTION_COST * neighbors
+
+   summed over the particles of the block. INTERACTION_COST is the
+   time of an interacting pair relative to a non-interacting one,
+   measured on this code with gcc -O2.
+
+   Process 0 reports, at the end, the average load imbalance (largest
+   over average work per process) of equal blocks ("static") and of
+   weighted blocks ("weighted"), both estimated from the costs, and
+   of the measured time of the processes ("measured") for each
+   phase. */
+#define INTERACTION_COST 10
+
+int *w_nbrs;       // neighbors of each local particle
+int *nbrs;         // neighbors of all particles
+long *cost_prefix; // prefix sums of the costs
+
+/* Processes in the order in which they receive the blocks of
+   particles (see below) */
+int *rank_order;
+
+#ifdef SHM
+/* Shared-memory mode (compile with -DSHM).
+
+   Normally every process keeps a full copy of particles[], refreshed
+   by MPI_Allgatherv() twice per step. With P processes per node,
+   every node holds P copies of the same array and the library copies
+   each block P times inside the node. In this mode the processes of
+   each node (found with MPI_Comm_split_type(MPI_COMM_TYPE_SHARED))
+   share a single particles[] array allocated with
+   MPI_Win_allocate_shared(). Each process works in place on its own
+   block (w_particles points into the shared array, so there is no
+   Scatterv and no local copy). Only the lowest-ranked process of each
+   node (the "leader") takes part in the exchange between nodes. That
+   exchange is an in-place MPI_Allgatherv() on the communicator of the
+   leaders, where each node contributes the contiguous slab of its
+   processes.
+
+   The window is accessed with plain loads and stores inside a
+   passive-target epoch (MPI_Win_lock_all()). node_exchange()
+   separates the phases with MPI_Win_sync() and barriers on the node
+   communicator. Within a phase, each process writes only the fields
+   of its own particles that no other process reads in that phase.
+   The blocks of the processes of a node are assigned consecutively
+   (rank_order[]), so that each node owns a contiguous slab. */
+MPI_Comm node_comm;                   // processes of this node
+MPI_Comm leader_comm = MPI_COMM_NULL; // one process per node
+MPI_Win shm_win;
+int node_rank, n_nodes;
+int *node_of;        // node of each process
+int *node_counts;    // particles of each node
+int *node_displs;    // first particle of each node
+
+void init_nodes(int comm_sz, int my_rank) {
+  int node = 0;
+
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL,
+                      &node_comm);
+  MPI_Comm_rank(node_comm, &node_rank);
+  MPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED, my_rank,
+                 &leader_comm);
+  if (leader_comm != MPI_COMM_NULL) {
+    MPI_Comm_rank(leader_comm, &node);
+    MPI_Comm_size(leader_comm, &n_nodes);
+  }
+  MPI_Bcast(&node, 1, MPI_INT, 0, node_comm);
+  MPI_Bcast(&n_nodes, 1, MPI_INT, 0, node_comm);
+
+  node_of = (int *)malloc(comm_sz * sizeof(*node_of));
+  node_counts = (int *)malloc(n_nodes * sizeof(*node_counts));
+  node_displs = (int *)malloc(n_nodes * sizeof(*node_displs));
+  assert(node_of != NULL && node_counts != NULL && node_displs != NULL);
+  MPI_Allgather(&node, 1, MPI_INT, node_of, 1, MPI_INT, MPI_COMM_WORLD);
+
+  /* Group the processes by node; world rank 0 is the leader of node 0 */
+  int k = 0;
+  for (int nd = 0; nd < n_nodes; nd++) {
+    for (int r = 0; r < comm_sz; r++) {
+      if (node_of[r] == nd)
+        rank_order[k++] = r;
+    }
+  }
+}
+
+/* Allocate the shared window with room for `n` particles, followed by
+   their neighbor counts; the memory is physically allocated by the
+   leader, and mapped by the other processes of the node. */
+void alloc_shared(int n, particle_t **p, int **nb) {
+  const MPI_Aint size = (node_rank == 0 ? (MPI_Aint)n * (sizeof(particle_t) + sizeof(int)) : 0);
+  MPI_Aint qsize;
+  int disp_unit;
+  char *base;
+
+  MPI_Win_allocate_shared(size, 1, MPI_INFO_NULL, node_comm, &base, &shm_win);
+  MPI_Win_shared_query(shm_win, 0, &qsize, &disp_unit, &base);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, shm_win);
+  *p = (particle_t *)base;
+  *nb = (int *)(base + (size_t)n * sizeof(particle_t));
+}
+
+/* Recompute the slab of each node from sendcounts[] and displs[] */
+void node_blocks(int comm_sz) {
+  for (int nd = 0; nd < n_nodes; nd++) {
+    node_counts[nd] = 0;
+    node_displs[nd] = n_particles;
+  }
+  for (int r = 0; r < comm_sz; r++) {
+    const int nd = node_of[r];
+    node_counts[nd] += sendcounts[r];
+    node_displs[nd] = (displs[r] < node_displs[nd] ? displs[r] : node_displs[nd]);
+  }
+}
+
+/* Make the writes of all processes to `buf` (an array in the shared
+   window with elements of type `type`) visible to all processes of all
+   nodes */
+void node_exchange(void *buf, MPI_Datatype type) {
+  MPI_Win_sync(shm_win);
+  MPI_Barrier(node_comm);
+  if (leader_comm != MPI_COMM_NULL) {
+    MPI_Win_sync(shm_win);
+    MPI_Allgatherv(MPI_IN_PLACE, 0, type, buf, node_counts, node_displs, type,
+                   leader_comm);
+  }
+  MPI_Barrier(node_comm);
+  MPI_Win_sync(shm_win);
+}
+#endif
+
+enum { PH_DENSITY, PH_FORCES, NPHASES };
+const char *phase_name[NPHASES] = {"compute_density_pressure", "compute_forces"};
+double phase_time[NPHASES]; // time of this process in each phase, current step
+double imb_static = 0.0, imb_weighted = 0.0, imb_measured[NPHASES];
+int imb_count = 0;
+
 /**
  * Return a random value in [a, b]
  */
@@ -158,6 +308,8 @@ int is_in_domain(float x, float y) {
  * For CUDA: the CPU must initialize the domain.
  */
 void init_sph(int n) {
+  /* calibrate the profiler here, before any timed section */
+  HPC_PROF_INIT();
   n_particles = 0;
   printf("Initializing with %d particles\n", n);
 
@@ -190,6 +342,7 @@ void compute_density_pressure(void) {
   /* Each process handle it's subset of particles */
   for (int i = 0; i < w_n_particles; i++) {
     particle_t *pi = &w_particles[i];
+    int nb = 0;
     pi->rho = 0.0;
     for (int j = 0; j < n_particles; j++) {
       const particle_t *pj = &particles[j];
@@ -200,9 +353,11 @@ void compute_density_pressure(void) {
 
       if (d2 < HSQ) {
         pi->rho += MASS * POLY6 * pow(HSQ - d2, 3.0);
+        nb++;
       }
     }
     pi->p = GAS_CONST * (pi->rho - REST_DENS);
+    w_nbrs[i] = nb;
   }
 }
 
@@ -298,10 +453,21 @@ float avg_velocities(void) {
  * process must communicate, receive and update it's 
  * particles array to every process of the communicator */
 void update(void) {
+  double t0 = hpc_gettime();
+  HPC_PROF_BEGIN("compute_density_pressure");
   compute_density_pressure();
-
+  HPC_PROF_END();
+  phase_time[PH_DENSITY] = hpc_gettime() - t0;
+
+#ifdef SHM
+  /* The forces need the density and pressure of all particles */
+  HPC_PROF_BEGIN("node_exchange");
+  node_exchange(particles, particletype);
+  HPC_PROF_END();
+#else
   /* Using Allgatherv for shorter code and possibile
    * optimization by the compiler */
+  HPC_PROF_BEGIN("allgatherv");
   MPI_Allgatherv(w_particles,  /* sendbuf       */
                 w_n_particles, /* sendcount     */
                 particletype,  /* sendtype      */
@@ -311,9 +477,26 @@ void update(void) {
                 particletype,  /* recvtype      */
                 MPI_COMM_WORLD /* comm          */
   );
+  HPC_PROF_END();
+#endif
 
+  t0 = hpc_gettime();
+  HPC_PROF_BEGIN("compute_forces");
   compute_forces();
-
+  HPC_PROF_END();
+  phase_time[PH_FORCES] = hpc_gettime() - t0;
+
+#ifdef SHM
+  /* integrate() overwrites the positions and velocities that the other
+     processes of the node may still be reading in compute_forces();
+     the forces themselves are never read by other processes, so no
+     exchange between nodes is needed here */
+  HPC_PROF_BEGIN("node_barrier");
+  MPI_Win_sync(shm_win);
+  MPI_Barrier(node_comm);
+  HPC_PROF_END();
+#else
+  HPC_PROF_BEGIN("allgatherv");
   MPI_Allgatherv(w_particles,  /* sendbuf       */
                 w_n_particles, /* sendcount     */
                 particletype,  /* sendtype      */
@@ -323,8 +506,104 @@ void update(void) {
                 particletype,  /* recvtype      */
                 MPI_COMM_WORLD /* comm          */
   );
+  HPC_PROF_END();
+#endif
 
+  HPC_PROF_BEGIN("integrate");
   integrate();
+  HPC_PROF_END();
+}
+
+/* Gather the neighbor counts of this step, and compute sendcounts[]
+ * and displs[] for the next step from the prefix sums of the costs;
+ * all processes compute the same partition. Also update the imbalance
+ * statistics. */
+void balance_partition(int comm_sz, int my_rank) {
+#ifdef SHM
+  node_exchange(nbrs, MPI_INT);
+#else
+  MPI_Allgatherv(w_nbrs,        /* sendbuf       */
+                 w_n_particles, /* sendcount     */
+                 MPI_INT,       /* sendtype      */
+                 nbrs,          /* recvbuf       */
+                 sendcounts,    /* recvcounts    */
+                 displs,        /* displacements */
+                 MPI_INT,       /* recvtype      */
+                 MPI_COMM_WORLD /* comm          */
+  );
+#endif
+
+  cost_prefix[0] = 0;
+  for (int i = 0; i < n_particles; i++) {
+    cost_prefix[i + 1] = cost_prefix[i] + n_particles + INTERACTION_COST * nbrs[i];
+  }
+  const long total = cost_prefix[n_particles];
+#ifdef SHM
+  /* The next step overwrites nbrs[] */
+  MPI_Barrier(node_comm);
+#endif
+
+  /* Imbalance of the equal blocks, and of the blocks actually used
+     in this step */
+  long max_eq = 0, max_w = 0;
+  for (int r = 0; r < comm_sz; r++) {
+    const int lo = n_particles * r / comm_sz, hi = n_particles * (r + 1) / comm_sz;
+    const long c_eq = cost_prefix[hi] - cost_prefix[lo];
+    const long c_w = cost_prefix[displs[r] + sendcounts[r]] - cost_prefix[displs[r]];
+    max_eq = (c_eq > max_eq ? c_eq : max_eq);
+    max_w = (c_w > max_w ? c_w : max_w);
+  }
+
+  /* The k-th block (assigned to process rank_order[k]) starts at the
+     first particle whose prefix reaches a fraction k/comm_sz of the
+     total cost */
+  int start = 0;
+  for (int k = 0; k < comm_sz; k++) {
+    const int r = rank_order[k];
+    int end = n_particles;
+    if (k < comm_sz - 1) {
+      const long target = total * (k + 1) / comm_sz;
+      end = start;
+      while (end < n_particles && cost_prefix[end] < target)
+        end++;
+    }
+    displs[r] = start;
+    sendcounts[r] = end - start;
+    start = end;
+  }
+  w_n_particles = sendcounts[my_rank];
+#ifdef SHM
+  node_blocks(comm_sz);
+  w_particles = particles + displs[my_rank];
+  w_nbrs = nbrs + displs[my_rank];
+#endif
+
+  /* Measured imbalance of each phase */
+  double tmax[NPHASES], tsum[NPHASES];
+  MPI_Reduce(phase_time, tmax, NPHASES, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  MPI_Reduce(phase_time, tsum, NPHASES, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (0 == my_rank) {
+    for (int ph = 0; ph < NPHASES; ph++) {
+      if (tsum[ph] > 0)
+        imb_measured[ph] += tmax[ph] * comm_sz / tsum[ph];
+    }
+    if (total > 0) {
+      imb_static += (double)max_eq * comm_sz / total;
+      imb_weighted += (double)max_w * comm_sz / total;
+    }
+    imb_count++;
+  }
+}
+
+void print_imbalance(void) {
+  if (imb_count == 0)
+    return;
+  printf("Load imbalance (max/avg work per process):\n");
+  printf("%-26s %10s %10s %10s\n", "phase", "static", "weighted", "measured");
+  for (int ph = 0; ph < NPHASES; ph++) {
+    printf("%-26s %10.3f %10.3f %10.3f\n", phase_name[ph], imb_static / imb_count,
+           imb_weighted / imb_count, imb_measured[ph] / imb_count);
+  }
 }
 
 #ifdef GUI
@@ -490,26 +769,63 @@ int main(int argc, char **argv) {
   /* Preparing Scatterv/Gatherv parameters */
   sendcounts = (int*)malloc(comm_sz * sizeof(*sendcounts)); assert(sendcounts != NULL);
   displs = (int*)malloc(comm_sz * sizeof(*displs)); assert(displs != NULL);
+  rank_order = (int*)malloc(comm_sz * sizeof(*rank_order)); assert(rank_order != NULL);
+  for (int i = 0; i < comm_sz; i++) {
+    rank_order[i] = i;
+  }
+#ifdef SHM
+  init_nodes(comm_sz, my_rank);
+#endif
 
   /* Proc 0 sends to every process of the communicator the total number of 
    * particles and the number of steps in input */
   MPI_Bcast(&n_particles, 1, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Bcast(&nsteps, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-  /* Compute starting and ending position of each block */
+  /* Compute starting and ending position of each block; the blocks
+   * are equal at the first step, and then balanced by
+   * balance_partition() */
   for(int i = 0; i < comm_sz; i++) {
     const int local_start = n_particles * i / comm_sz;
     const int local_end = n_particles * (i + 1) / comm_sz;
     const int blklen = local_end - local_start;
-    sendcounts[i] = blklen;
-    displs[i] = local_start;
+    sendcounts[rank_order[i]] = blklen;
+    displs[rank_order[i]] = local_start;
   }
 
   w_n_particles = sendcounts[my_rank];
-  w_particles = (particle_t *)malloc(w_n_particles * sizeof(*w_particles));
+  cost_prefix = (long *)malloc((n_particles + 1) * sizeof(*cost_prefix));
+  assert(cost_prefix != NULL);
+#ifdef SHM
+  /* Proc 0 copies the generated particles into the shared array of its
+   * node, and the leaders share them with the other nodes */
+  particle_t *shared;
+  alloc_shared(n_particles, &shared, &nbrs);
+  if (0 == my_rank) {
+    memcpy(shared, particles, n_particles * sizeof(*particles));
+  }
+  free(particles);
+  particles = shared;
+  if (leader_comm != MPI_COMM_NULL) {
+    MPI_Bcast(particles, n_particles, particletype, 0, leader_comm);
+  }
+  MPI_Win_sync(shm_win);
+  MPI_Barrier(node_comm);
+  MPI_Win_sync(shm_win);
+  node_blocks(comm_sz);
+  w_particles = particles + displs[my_rank];
+  w_nbrs = nbrs + displs[my_rank];
+#else
+  /* The blocks change size at each step, so the local arrays are
+   * allocated with room for all particles */
+  w_particles = (particle_t *)malloc(n_particles * sizeof(*w_particles));
+  w_nbrs = (int *)malloc(n_particles * sizeof(*w_nbrs));
+  nbrs = (int *)malloc(n_particles * sizeof(*nbrs));
+  assert(w_particles != NULL && w_nbrs != NULL && nbrs != NULL);
 
   /* Finally, proc 0 shares to every process the generated partiucles */
   MPI_Bcast(particles, n_particles, particletype, 0, MPI_COMM_WORLD);
+#endif
 
   /* Only Proc 0 keeps track of the execution time */
   if (0 == my_rank) {
@@ -517,7 +833,9 @@ int main(int argc, char **argv) {
   }
 
   for (int s = 0; s < nsteps; s++) {
+    HPC_PROF_BEGIN("step");
 
+#ifndef SHM
     /* Every process retrieves their subset of particles to work with */
     MPI_Scatterv(particles,    /* senbuf        */
                 sendcounts,    /* sendcounts     */
@@ -529,9 +847,13 @@ int main(int argc, char **argv) {
                 0,             /* root          */
                 MPI_COMM_WORLD /* comm          */
     );
+#endif
 
     update();
 
+#ifdef SHM
+    node_exchange(particles, particletype);
+#else
     /* Update global particles array with computed values above, and
      * broadcast it to each process */
     MPI_Allgatherv(w_particles,  /* sendbuf       */
@@ -543,11 +865,16 @@ int main(int argc, char **argv) {
                   particletype,  /* recvtype      */
                   MPI_COMM_WORLD /* comm          */
     );
+#endif
 
     /* the average velocities MUST be computed at each step, even
        if it is not shown (to ensure constant workload per
        iteration) */
     const float partial_avg = avg_velocities();
+
+    HPC_PROF_BEGIN("balance_partition");
+    balance_partition(comm_sz, my_rank);
+    HPC_PROF_END();
     float avg = 0.0;
 
     /* Computing avg_velocities through a reduction for maximizing performances */
@@ -562,14 +889,32 @@ int main(int argc, char **argv) {
 
     if (0 == my_rank && s % 10 == 0)
       printf("step %5d, avgV=%f\n", s, avg);
+    HPC_PROF_END();
   }
 
   if (0 == my_rank) {
     printf("Elapsed time: %f\n", hpc_gettime() - tstart);
+    print_imbalance();
   }
 
   /* Releasing resources for local working array */
+  free(cost_prefix);
+  free(rank_order);
+#ifdef SHM
+  MPI_Win_unlock_all(shm_win);
+  MPI_Win_free(&shm_win);
+  particles = NULL; // freed with the window
+  free(node_of);
+  free(node_counts);
+  free(node_displs);
+  if (leader_comm != MPI_COMM_NULL)
+    MPI_Comm_free(&leader_comm);
+  MPI_Comm_free(&node_comm);
+#else
   free(w_particles);
+  free(w_nbrs);
+  free(nbrs);
+#endif
   MPI_Finalize();
 
 #endif
@@ -0,0 +1,145 @@
+"""Python bindings for the SPH simulator in omp-sph.c.
+
+The simulator is compiled as a shared library (``make libsph.so``, by
+default with the k-d tree neighbor search; ``PCISPH=1 make libsph.so``
+for the incompressible solver) and loaded with ctypes, so that no
+compiler is needed on the Python side. The particles are exposed as a
+NumPy structured array that *shares* the memory of the simulator:
+
+    >>> import sph
+    >>> sim = sph.Simulation(max_particles=10**6, width=60000, height=40000)
+    >>> sim.reset(10**6)
+    >>> sim.run(100, callback=lambda sim, s: print(s, sim.particles["rho"].mean()),
+    ...         every=10)
+
+ctypes releases the GIL while the simulator runs, so other Python
+threads (e.g., a notebook kernel) are not blocked during a step. The
+simulation state lives in global variables of the library, so only one
+Simulation may exist at a time.
+"""
+
+import ctypes
+import os
+
+import numpy as np
+
+#: Layout of particle_t in omp-sph.c
+PARTICLE_DTYPE = np.dtype([(name, np.float32) for name in
+                           ("x", "y", "vx", "vy", "fx", "fy", "rho", "p")])
+
+
+def _load(path):
+    lib = ctypes.CDLL(path)
+    lib.sph_init.argtypes = [ctypes.c_int, ctypes.c_float, ctypes.c_float]
+    lib.sph_init.restype = ctypes.c_int
+    lib.sph_reset.argtypes = [ctypes.c_int, ctypes.c_uint]
+    lib.sph_reset.restype = ctypes.c_int
+    lib.sph_step.argtypes = [ctypes.c_int]
+    lib.sph_step.restype = None
+    lib.sph_avg_velocity.argtypes = []
+    lib.sph_avg_velocity.restype = ctypes.c_float
+    lib.sph_particles.argtypes = []
+    lib.sph_particles.restype = ctypes.c_void_p
+    lib.sph_n_particles.argtypes = []
+    lib.sph_n_particles.restype = ctypes.c_int
+    lib.sph_set_n_particles.argtypes = [ctypes.c_int]
+    lib.sph_set_n_particles.restype = ctypes.c_int
+    lib.sph_max_particles.argtypes = []
+    lib.sph_max_particles.restype = ctypes.c_int
+    lib.sph_finalize.argtypes = []
+    lib.sph_finalize.restype = None
+    return lib
+
+
+class Simulation:
+    """A simulation of up to `max_particles` particles in a domain of
+    size `width` x `height` (the default is the domain of omp-sph)."""
+
+    _active = False
+
+    def __init__(self, max_particles=20000, width=4500.0, height=3000.0,
+                 library=None):
+        if Simulation._active:
+            raise RuntimeError("only one Simulation may exist at a time")
+        if library is None:
+            library = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                   "libsph.so")
+        self._lib = _load(library)
+        if self._lib.sph_init(max_particles, width, height) != 0:
+            raise ValueError("invalid simulation parameters")
+        Simulation._active = True
+        self.step_count = 0
+
+    def close(self):
+        """Release the memory of the simulator; the arrays returned by
+        `particles` must not be used afterwards."""
+        if self._lib is not None:
+            self._lib.sph_finalize()
+            self._lib = None
+            Simulation._active = False
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def reset(self, n, seed=1234):
+        """Start from the initial state of omp-sph with `n` particles
+        (the same state as ``omp-sph n`` with the default seed)."""
+        if self._lib.sph_reset(n, seed) != 0:
+            raise ValueError("%d particles do not fit" % n)
+        self.step_count = 0
+
+    @property
+    def n_particles(self):
+        return self._lib.sph_n_particles()
+
+    @n_particles.setter
+    def n_particles(self, n):
+        """Set the number of active particles, after writing their
+        state into `particles_buffer`."""
+        if self._lib.sph_set_n_particles(n) != 0:
+            raise ValueError("at most %d particles" % self._lib.sph_max_particles())
+
+    def _view(self, n):
+        ptr = self._lib.sph_particles()
+        buf = (ctypes.c_char * (n * PARTICLE_DTYPE.itemsize)).from_address(ptr)
+        return np.frombuffer(buf, dtype=PARTICLE_DTYPE, count=n)
+
+    @property
+    def particles(self):
+        """The active particles as a structured array (fields x, y, vx,
+        vy, fx, fy, rho, p) that shares memory with the simulator:
+        writes go directly into the simulation. The array is only
+        valid until the next step, which may move the particles to
+        another buffer (with the k-d tree they are reordered at every
+        step); get it again from this property after each step."""
+        return self._view(self.n_particles)
+
+    @property
+    def particles_buffer(self):
+        """Like `particles`, but covering the whole capacity; used to
+        build a custom initial state (then set `n_particles`)."""
+        return self._view(self._lib.sph_max_particles())
+
+    def avg_velocity(self):
+        return self._lib.sph_avg_velocity()
+
+    def step(self, nsteps=1):
+        """Advance `nsteps` steps; the GIL is released meanwhile."""
+        self._lib.sph_step(nsteps)
+        self.step_count += nsteps
+
+    def run(self, nsteps, callback=None, every=1):
+        """Advance `nsteps` steps, calling ``callback(self, step)`` every
+        `every` steps (and at the end); the run stops early if the
+        callback returns False. The steps between two calls run in
+        the library without returning to Python."""
+        done = 0
+        while done < nsteps:
+            k = min(every, nsteps - done)
+            self.step(k)
+            done += k
+            if callback is not None and callback(self, self.step_count) is False:
+                break
@@ -21,7 +21,7 @@
 /***
 % HPC - Sieve of Eratosthenes
 % Moreno Marzolla <moreno.marzolla@unibo.it>
-% Last updated: 2022-08-10
+% Last updated: 2026-10-18
 
 The _sieve of Erathostenes_ is an algorithm for identifying the prime
 numbers falling within a given range which usually is the set $\{2,
@@ -114,7 +114,7 @@ Compile with:
 
 Execute with:
 
-        ./omp-sieve [n]
+        ./omp-sieve [-l] [n]
 
 Example:
 
@@ -140,6 +140,48 @@ $n$. Use the table to check the correctness of your implementation
   10000000000  **Do not try on the server**: uses >10GB of RAM!!
 -------------  -----------------------------------
 
+## Counting primes without sieving
+
+If only $\pi(n)$ is needed, there is no need to find all primes up
+to $n$. The `-l` option computes $\pi(n)$ with the algorithm of
+Lagarias, Miller and Odlyzko (LMO), that requires time $O(n^{2/3}
+\log n)$ and memory $O(n^{1/2})$ for the tables of small primes:
+
+        ./omp-sieve -l 1000000000000000
+
+The algorithm chooses $y$ slightly larger than $n^{1/3}$, and uses
+
+$$
+\pi(n) = \phi(n, a) + a - 1 - P_2(n, a)
+$$
+
+where $a = \pi(y)$, $\phi(n, a)$ is the number of integers in $\{1,
+\ldots, n\}$ that are not divisible by any of the first $a$ primes,
+and $P_2(n, a)$ is the number of integers in $\{1, \ldots, n\}$ that
+are the product of exactly two primes greater than $y$. $\phi(n, a)$
+is the sum of $O(y)$ _ordinary leaves_, that are computed directly,
+and of the _special leaves_ $-\mu(m) \phi(n / (pm), b)$, whose
+arguments $n / (pm)$ are smaller than $n / y$. These are computed by
+a segmented sieve of Eratosthenes over $\{1, \ldots, n / y\}$ that
+crosses off one prime at a time, and counts the remaining integers
+with a Fenwick tree. The segments are split among OpenMP threads;
+each thread counts from the beginning of its own segments, and the
+counts of the previous segments are added at the end. The primes up
+to $\sqrt{n}$ are computed with the sieve above.
+
+Table 2 shows some values that can be used to check the program.
+
+:Table 2: more values of $\pi(n)$ (`-l` option only)
+
+          $n$                             $\pi(n)$
+-------------  -----------------------------------
+    $10^{10}$                            455052511
+    $10^{12}$                          37607912018
+    $10^{14}$                        3204941750802
+    $10^{15}$                       29844570422669
+    $10^{16}$                      279238341033925
+-------------  -----------------------------------
+
 ## Files
 
 - [omp-sieve.c](omp-sieve.c)
@@ -148,6 +190,9 @@ $n$. Use the table to check the correctness of your implementation
 #include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <assert.h>
 
 /* Mark all mutliples of `p` in the set {`from`, ..., `to`-1}; return how
@@ -184,12 +229,472 @@ long mark( char *isprime, long from, long to, long p )
     return nmarked;
 }
 
+/*
+ * Sublinear prime counting with the Lagarias-Miller-Odlyzko (LMO)
+ * algorithm; see the comment at the top of this file.
+ */
+
+/* Largest argument of lmo_pi(); the small tables take O(sqrt(x)) memory */
+#define LMO_MAX 10000000000000000l
+
+/* Largest r such that r*r <= x */
+long isqrt( long x )
+{
+    long r = 0, step;
+    for (step = 1l << 31; step > 0; step >>= 1) {
+        if ((r + step) <= x / (r + step)) {
+            r += step;
+        }
+    }
+    return r;
+}
+
+/* Largest r such that r*r*r <= x */
+long icbrt( long x )
+{
+    long r = 0, step;
+    for (step = 1l << 21; step > 0; step >>= 1) {
+        if ((r + step) <= x / (r + step) / (r + step)) {
+            r += step;
+        }
+    }
+    return r;
+}
+
+/* Return the primes up to `limit` computed with the sieve of
+   Eratosthenes above; primes[0] = 0, so that primes[i] is the i-th
+   prime, i = 1 .. *nprimes */
+long *small_primes( long limit, long *nprimes )
+{
+    char *isprime = (char*)malloc(limit+1); assert(isprime != NULL);
+    long i, n = 0;
+
+    for (i=0; i<=limit; i++)
+        isprime[i] = 1;
+    for (i=2; i*i <= limit; i++) {
+        if (isprime[i]) {
+            mark(isprime, i*i, limit+1, i);
+        }
+    }
+    for (i=2; i<=limit; i++)
+        n += isprime[i];
+    long *primes = (long*)malloc((n+1) * sizeof(*primes)); assert(primes != NULL);
+    primes[0] = 0;
+    n = 0;
+    for (i=2; i<=limit; i++) {
+        if (isprime[i]) {
+            primes[++n] = i;
+        }
+    }
+    free(isprime);
+    *nprimes = n;
+    return primes;
+}
+
+typedef struct {
+    long x, y;          /* x and the sieving limit y */
+    long z;             /* x / y: the largest argument of phi() in the special leaves */
+    long a;             /* pi(y) */
+    long b_y;           /* pi(sqrt(y)) */
+    long b_s;           /* pi(sqrt(z)) */
+    long sqrt_x;
+    long *primes;       /* primes[1 .. nprimes] are the primes up to max(y, sqrt(x)) */
+    long nprimes;
+    signed char *mu;    /* mu[m] is the Moebius function of m, m <= y */
+    int *lpf;           /* lpf[m] is the least prime factor of m <= y (lpf[1] = INT_MAX) */
+    int *pi;            /* pi[m] is the number of primes <= m, m <= y */
+    long seg_size;      /* numbers per segment (multiple of 64, and >= y) */
+    long nsegs;         /* segments of [1, z] */
+} lmo_t;
+
+/* Partial results of a chunk of consecutive segments */
+typedef struct {
+    long s2;            /* special leaves, counting only the chunk */
+    long *phi;          /* phi[b]: numbers of the chunk coprime to the first b primes */
+    long *mu_sum;       /* mu_sum[b]: sum of mu(m) of the leaves that used phi[b] */
+    long p2;            /* P2 terms, counting only the chunk */
+    long p2_count;      /* number of P2 terms */
+} chunk_t;
+
+/* A segment [low, low + seg_size) of the special leaves sieve; bit k
+   of `bits` is set iff low + k has not been crossed off. Before all
+   primes up to sqrt(z) are crossed off, the bits set are counted
+   with a Fenwick tree over words; afterwards, with a prefix sum. */
+typedef struct {
+    long low, high;
+    long nwords;
+    uint64_t *bits;
+    long *tree;         /* tree[1 .. nwords] */
+    long *prefix;       /* prefix[w] = bits set in words 0 .. w-1 */
+    long count;         /* total bits set */
+} segment_t;
+
+void fenwick_add( segment_t *s, long w, long v )
+{
+    for (w++; w <= s->nwords; w += w & -w)
+        s->tree[w] += v;
+}
+
+/* Number of bits set in words 0 .. w-1 */
+long fenwick_sum( const segment_t *s, long w )
+{
+    long sum = 0;
+    for (; w > 0; w -= w & -w)
+        sum += s->tree[w];
+    return sum;
+}
+
+/* Mask of bits 0 .. k%64 of a word */
+uint64_t low_bits( long k )
+{
+    return (((uint64_t)2) << (k % 64)) - 1;
+}
+
+/* Number of integers in [low, v] not crossed off, using the Fenwick tree */
+long count_dynamic( const segment_t *s, long v )
+{
+    const long k = v - s->low;
+    return fenwick_sum(s, k/64) + __builtin_popcountll(s->bits[k/64] & low_bits(k));
+}
+
+/* Number of integers in [low, v] not crossed off, using the prefix sums */
+long count_static( const segment_t *s, long v )
+{
+    const long k = v - s->low;
+    return s->prefix[k/64] + __builtin_popcountll(s->bits[k/64] & low_bits(k));
+}
+
+void segment_init( segment_t *s, long low, long high )
+{
+    const long n = high - low;
+    long w;
+
+    s->low = low;
+    s->high = high;
+    for (w=0; w<s->nwords; w++) {
+        s->bits[w] = (n >= 64*(w+1) ? ~(uint64_t)0 : (n > 64*w ? low_bits(n - 64*w - 1) : 0));
+        s->tree[w+1] = __builtin_popcountll(s->bits[w]);
+    }
+    for (w=1; w<=s->nwords; w++) {
+        const long parent = w + (w & -w);
+        if (parent <= s->nwords)
+            s->tree[parent] += s->tree[w];
+    }
+    s->count = n;
+}
+
+/* Cross off the multiples of p (including p) from the segment */
+void segment_cross( segment_t *s, long p )
+{
+    long j = (s->low + p - 1) / p * p;
+    if (j < p)
+        j = p;
+    for (; j < s->high; j += p) {
+        const long k = j - s->low;
+        const uint64_t bit = ((uint64_t)1) << (k % 64);
+        if (s->bits[k/64] & bit) {
+            s->bits[k/64] &= ~bit;
+            fenwick_add(s, k/64, -1);
+            s->count--;
+        }
+    }
+}
+
+void segment_freeze( segment_t *s )
+{
+    long w;
+    s->prefix[0] = 0;
+    for (w=0; w<s->nwords; w++)
+        s->prefix[w+1] = s->prefix[w] + __builtin_popcountll(s->bits[w]);
+}
+
+/*
+ * Process the special leaves -mu(m) phi(x / (p m), b), with p the
+ * (b+1)-th prime, whose argument x / (p m) falls in the segment `s`;
+ * the values of phi() are counted from the beginning of the chunk
+ * (see lmo_chunk()).
+ */
+void segment_leaves( const lmo_t *L, const segment_t *s, long b, chunk_t *r )
+{
+    const long p = L->primes[b+1];
+    const long x = L->x;
+    long m_max = x / (p * s->low), m_min = x / (p * s->high), m;
+
+    if (m_max > L->y) m_max = L->y;
+    if (m_min < L->y / p) m_min = L->y / p;
+    if (m_max <= m_min)
+        return;
+    if (b < L->b_y) {
+        /* any square-free m with all prime factors larger than p */
+        for (m = m_max; m > m_min; m--) {
+            if (L->mu[m] != 0 && L->lpf[m] > p) {
+                const long phi = r->phi[b] + count_dynamic(s, x / (p * m));
+                r->s2 -= L->mu[m] * phi;
+                r->mu_sum[b] += L->mu[m];
+            }
+        }
+    } else {
+        /* p > sqrt(y), therefore m must be a prime q > p; mu(q) = -1 */
+        long l_min = (m_min > p ? L->pi[m_min] : b+1), l;
+        for (l = L->pi[m_max]; l > l_min; l--) {
+            const long v = x / (p * L->primes[l]);
+            if (b < L->b_s) {
+                r->s2 += r->phi[b] + count_dynamic(s, v);
+                r->mu_sum[b]--;
+            } else {
+                /* all primes up to sqrt(z) > sqrt(v) have been crossed
+                   off, therefore phi(v, b) = phi(v, b_s) - (b - b_s) if
+                   v is at least the b-th prime; smaller values of v
+                   (where phi(v, b) = 1) occur only in the first segment */
+                const long phi = r->phi[L->b_s] + count_static(s, v) - (b - L->b_s);
+                if (s->low == 1) {
+                    r->s2 += (phi > 1 ? phi : 1);
+                } else {
+                    r->s2 += phi;
+                    r->mu_sum[L->b_s]--;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * P2 terms pi(x/p) - pi(p) + 1 for the primes y < p <= sqrt(x) such
+ * that x/p falls in the segment `s`, which has been crossed off by
+ * all primes up to sqrt(z): pi(v) = phi(v, b_s) - 1 + b_s.
+ */
+void segment_p2( const lmo_t *L, const segment_t *s, chunk_t *r )
+{
+    long p_min = L->x / s->high, p_max = L->x / s->low;
+    long lo = 1, hi = L->nprimes + 1, l;
+
+    if (p_min < L->y) p_min = L->y;
+    if (p_max > L->sqrt_x) p_max = L->sqrt_x;
+    /* first prime greater than p_min */
+    while (lo < hi) {
+        const long mid = (lo + hi) / 2;
+        if (L->primes[mid] <= p_min) lo = mid + 1; else hi = mid;
+    }
+    for (l = lo; l <= L->nprimes && L->primes[l] <= p_max; l++) {
+        const long v = L->x / L->primes[l];
+        r->p2 += r->phi[L->b_s] + count_static(s, v) - 1 + L->b_s - l + 1;
+        r->p2_count++;
+    }
+}
+
+/* Process segments [seg_first, seg_last) */
+void lmo_chunk( const lmo_t *L, segment_t *s, long seg_first, long seg_last, chunk_t *r )
+{
+    long seg, b;
+
+    for (seg = seg_first; seg < seg_last; seg++) {
+        const long low = 1 + seg * L->seg_size;
+        const long high = (low + L->seg_size <= L->z + 1 ? low + L->seg_size : L->z + 1);
+        segment_init(s, low, high);
+        for (b = 0; b < L->b_s; b++) {
+            if (b + 1 < L->a)
+                segment_leaves(L, s, b, r);
+            r->phi[b] += s->count;
+            segment_cross(s, L->primes[b+1]);
+        }
+        segment_freeze(s);
+        /* the remaining leaves of the first segment are processed by
+           lmo_first_segment() */
+        for (b = L->b_s; b + 1 < L->a && low > 1; b++) {
+            const long p = L->primes[b+1];
+            if (p > L->x / low / p)
+                break;
+            segment_leaves(L, s, b, r);
+        }
+        segment_p2(L, s, r);
+        r->phi[L->b_s] += s->count;
+    }
+}
+
+void segment_alloc( segment_t *s, long size )
+{
+    s->nwords = size / 64;
+    s->bits = (uint64_t*)malloc(s->nwords * sizeof(uint64_t));
+    s->tree = (long*)malloc((s->nwords + 1) * sizeof(long));
+    s->prefix = (long*)malloc((s->nwords + 1) * sizeof(long));
+    assert(s->bits != NULL && s->tree != NULL && s->prefix != NULL);
+}
+
+void segment_free( segment_t *s )
+{
+    free(s->bits);
+    free(s->tree);
+    free(s->prefix);
+}
+
+/*
+ * The leaves with b >= b_s whose argument falls in the first segment
+ * are a large fraction of all special leaves (they are the leaves
+ * with the largest p and q). Once the first segment has been crossed
+ * off by the primes up to sqrt(z) it does not change, so these
+ * leaves are split among threads by b. Must be called by all threads
+ * of a parallel region; returns the sum of the leaves.
+ */
+long lmo_first_segment( const lmo_t *L, const segment_t *first )
+{
+    chunk_t r;
+    long b;
+
+    r.s2 = 0;
+    r.phi = (long*)calloc(L->b_s + 1, sizeof(long));
+    r.mu_sum = (long*)calloc(L->b_s + 1, sizeof(long));
+    assert(r.phi != NULL && r.mu_sum != NULL);
+#pragma omp for schedule(dynamic, 16)
+    for (b = L->b_s; b < L->a - 1; b++) {
+        segment_leaves(L, first, b, &r);
+    }
+    free(r.phi);
+    free(r.mu_sum);
+    return r.s2;
+}
+
+/* Return pi(x) computed with the LMO algorithm */
+long lmo_pi( long x )
+{
+    lmo_t L;
+    long i, m;
+
+    /* small values are counted directly */
+    if (x < 1000) {
+        long n;
+        free(small_primes(x > 2 ? x : 2, &n));
+        return (x < 2 ? 0 : n);
+    }
+
+    L.x = x;
+    L.sqrt_x = isqrt(x);
+    /* The optimal value of y = alpha * x^(1/3) balances the cost of
+       the special leaves (that grows with y) and the cost of sieving
+       [1, x/y]; alpha, that grows with the number of digits of x, has
+       been determined empirically */
+    const long x13 = icbrt(x);
+    int digits = 0;
+    for (m = x; m > 0; m /= 10)
+        digits++;
+    const double alpha = (digits > 9 ? digits - 8 : 1);
+    L.y = (long)(alpha * x13);
+    /* y > x^(1/3) guarantees that sqrt(z) < y */
+    if (L.y <= x13) L.y = x13 + 1;
+    if (L.y > L.sqrt_x) L.y = L.sqrt_x;
+    L.z = x / L.y;
+
+    L.primes = small_primes(L.sqrt_x, &L.nprimes);
+
+    /* tables of mu(), lpf() and pi() up to y */
+    L.mu = (signed char*)malloc(L.y + 1);
+    L.lpf = (int*)malloc((L.y + 1) * sizeof(int));
+    L.pi = (int*)malloc((L.y + 1) * sizeof(int));
+    assert(L.mu != NULL && L.lpf != NULL && L.pi != NULL);
+    for (m=0; m<=L.y; m++) {
+        L.mu[m] = 1;
+        L.lpf[m] = INT_MAX;
+        L.pi[m] = 0;
+    }
+    for (i=1; i <= L.nprimes && L.primes[i] <= L.y; i++) {
+        const long p = L.primes[i];
+        for (m = p; m <= L.y; m += p) {
+            L.mu[m] = -L.mu[m];
+            if (L.lpf[m] == INT_MAX)
+                L.lpf[m] = p;
+        }
+        for (m = p*p; m <= L.y; m += p*p) {
+            L.mu[m] = 0;
+        }
+        L.pi[p] = 1;
+    }
+    for (m=1; m<=L.y; m++)
+        L.pi[m] += L.pi[m-1];
+    L.a = L.pi[L.y];
+    L.b_y = L.pi[isqrt(L.y)];
+    L.b_s = L.pi[isqrt(L.z)];
+
+    /* Ordinary leaves S1 = sum_{n <= y} mu(n) * floor(x/n) */
+    long s1 = 0;
+#pragma omp parallel for default(none) shared(L, x) reduction(+:s1) schedule(static)
+    for (m=1; m<=L.y; m++) {
+        s1 += L.mu[m] * (x / m);
+    }
+
+    /* Special leaves and P2: the segments of [1, z] are split into
+       chunks that are processed in parallel. Each chunk computes phi()
+       from its first segment; the contribution of the previous chunks
+       is added afterwards */
+    L.seg_size = (L.y + 63) / 64 * 64;
+    L.nsegs = (L.z + L.seg_size - 1) / L.seg_size;
+    const long nchunks = (L.nsegs < 64 * omp_get_max_threads() ? L.nsegs : 64 * omp_get_max_threads());
+    chunk_t *chunks = (chunk_t*)malloc(nchunks * sizeof(*chunks));
+    assert(chunks != NULL);
+    for (i=0; i<nchunks; i++) {
+        chunks[i].s2 = chunks[i].p2 = chunks[i].p2_count = 0;
+        chunks[i].phi = (long*)calloc(L.b_s + 1, sizeof(long));
+        chunks[i].mu_sum = (long*)calloc(L.b_s + 1, sizeof(long));
+        assert(chunks[i].phi != NULL && chunks[i].mu_sum != NULL);
+    }
+    segment_t first;
+    segment_alloc(&first, L.seg_size);
+    segment_init(&first, 1, (1 + L.seg_size <= L.z + 1 ? 1 + L.seg_size : L.z + 1));
+    for (i=1; i<=L.b_s; i++)
+        segment_cross(&first, L.primes[i]);
+    segment_freeze(&first);
+
+    long s2 = 0, p2 = 0, b;
+#pragma omp parallel default(none) shared(L, chunks, nchunks, first) reduction(+:s2)
+    {
+        segment_t s;
+        long c;
+        segment_alloc(&s, L.seg_size);
+        /* the first chunks contain most of the special leaves, and
+           take longer */
+#pragma omp for schedule(dynamic) nowait
+        for (c=0; c<nchunks; c++) {
+            lmo_chunk(&L, &s, L.nsegs * c / nchunks, L.nsegs * (c+1) / nchunks, &chunks[c]);
+        }
+        segment_free(&s);
+        s2 += lmo_first_segment(&L, &first);
+    }
+    segment_free(&first);
+
+    long *phi_before = (long*)calloc(L.b_s + 1, sizeof(long));
+    assert(phi_before != NULL);
+    for (i=0; i<nchunks; i++) {
+        s2 += chunks[i].s2;
+        p2 += chunks[i].p2 + chunks[i].p2_count * phi_before[L.b_s];
+        for (b=0; b<=L.b_s; b++) {
+            s2 -= chunks[i].mu_sum[b] * phi_before[b];
+            phi_before[b] += chunks[i].phi[b];
+        }
+        free(chunks[i].phi);
+        free(chunks[i].mu_sum);
+    }
+
+    free(phi_before);
+    free(chunks);
+    free(L.primes);
+    free(L.mu);
+    free(L.lpf);
+    free(L.pi);
+    /* pi(x) = phi(x, a) + a - 1 - P2(x, a) */
+    return s1 + s2 + L.a - 1 - p2;
+}
+
 int main( int argc, char *argv[] )
 {
     long n = 1000000l, nprimes, i;
+    int use_lmo = 0;
+
+    if ( argc > 1 && 0 == strcmp(argv[1], "-l") ) {
+        use_lmo = 1;
+        argc--;
+        argv++;
+    }
 
     if ( argc > 2 ) {
-        fprintf(stderr, "Usage: %s [n]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-l] [n]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -197,6 +702,19 @@ int main( int argc, char *argv[] )
         n = atol(argv[1]);
     }
 
+    if ( use_lmo ) {
+        if (n > LMO_MAX) {
+            fprintf(stderr, "FATAL: n too large (max %ld)\n", LMO_MAX);
+            return EXIT_FAILURE;
+        }
+        const double tstart = omp_get_wtime();
+        nprimes = lmo_pi(n);
+        const double elapsed = omp_get_wtime() - tstart;
+        printf("There are %ld primes in {2, ..., %ld}\n", nprimes, n);
+        printf("Elapsed time: %f\n", elapsed);
+        return EXIT_SUCCESS;
+    }
+
     if (n > (1ul << 31)) {
         fprintf(stderr, "FATAL: n too large\n");
         return EXIT_FAILURE;
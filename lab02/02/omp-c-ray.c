@@ -25,7 +25,7 @@
 /***
 % HPC - Ray tracing
 % Moreno Marzolla <moreno.marzolla@unibo.it>
-% Last updated: 2022-05-03
+% Last updated: 2026-10-18
 
 The file [omp-c-ray.c](omp-c-ray.c) contains the implementation of a
 [simple ray tracing program](https://github.com/jtsiomb/c-ray) written
@@ -116,6 +116,53 @@ high variability in the time required to compute the color of each
 pixel, which leads to load imbalance that should be addressed in some
 way.
 
+## Shadow rays
+
+For each light, `shade()` casts a shadow ray to decide whether the
+light is visible from the point being shaded. With $n$ spheres and
+$l$ lights, testing each shadow ray against every sphere costs $O(nl)$
+intersection tests per shading point, and this dominates the render
+time when most points are lit (a lit point must test all spheres).
+The program reduces this cost as follows:
+
+- the shadow ray is first tested against the sphere the point lies
+  on (the far side of the sphere itself is the most common occluder),
+  then against the last sphere that occluded the same light for the
+  same thread, since adjacent pixels almost always have the same
+  occluder;
+
+- when the scene is loaded, the spheres that cannot occlude any other
+  sphere from a light are removed from the list of occluders of that
+  light; a sphere $S$ can hide a point of a sphere $T$ from the light
+  only if the cones from the light tangent to $S$ and $T$ overlap,
+  and some point of $T$ is farther from the light than the nearest
+  point of $S$;
+
+- the remaining occluders of each light are stored in a bounding
+  volume hierarchy (BVH) of axis-aligned boxes, that is traversed
+  until _any_ intersection is found (the nearest one is not needed).
+
+Since a shadow ray only needs a yes/no answer, the image is the same
+as the one computed by testing all spheres, which can be done with
+the `-b` option to compare the execution times. The number of shadow
+rays and of ray-sphere intersection tests are printed to stderr.
+
+## Reflection rays
+
+A reflection ray spawned after $k$ bounces contributes to the pixel
+with a _weight_ equal to the product of the reflectivities of the
+$k$ surfaces; e.g., in [dna.in](dna.in) most spheres have
+reflectivity 0.2, so the third reflection has weight $0.2^3 = 0.008$
+and cannot change the pixel by more than a few units out of 255.
+Reflection rays with weight below a threshold (option `-e`, default
+0.01) are not traced; `-e 0` traces all rays up to the maximum depth
+as the original program. With the `-R` option, such rays are instead
+traced with probability _weight / threshold_ and their color is
+scaled accordingly (_Russian roulette_): the expected pixel color
+does not change, at the cost of some noise. The number of rays traced
+and of reflection rays that are not traced at each depth are printed
+to stderr.
+
 ## Files
 
 - [omp-c-ray.c](omp-c-ray.c)
@@ -175,13 +222,33 @@ typedef struct {
     uint8_t b;  /* blue  */
 } pixel_t;
 
+typedef struct {
+    vec3_t lo, hi;              /* bounding box */
+    int first, count;           /* leaf: spheres prims[first .. first+count-1];
+                                   internal node (count == 0): children are
+                                   nodes[first] and nodes[first+1] */
+} bvh_node_t;
+
+typedef struct {
+    bvh_node_t *nodes;
+    const sphere_t **prims;
+    int nprims;
+} bvh_t;
+
+typedef struct {
+    long rays;                  /* shadow rays cast */
+    long tests;                 /* ray-sphere intersection tests */
+    long self_hits;             /* rays blocked by the shaded sphere */
+    long cache_hits;            /* rays blocked by the cached occluder */
+} shadow_stats_t;
+
 /* forward declarations */
-vec3_t trace(ray_t ray, int depth);
-vec3_t shade(sphere_t *obj, spoint_t *sp, int depth);
+vec3_t trace(ray_t ray, int depth, double weight);
+vec3_t shade(sphere_t *obj, spoint_t *sp, int depth, double weight);
 
 #define MAX_LIGHTS	16		/* maximum number of lights     */
 const double RAY_MAG = 1000.0;		/* trace rays of this magnitude */
-const int MAX_RAY_DEPTH	= 5;		/* raytrace recursion limit     */
+#define MAX_RAY_DEPTH	5		/* raytrace recursion limit     */
 const double ERR_MARGIN	= 1e-6;		/* an arbitrary error margin to avoid surface acne */
 const double DEG_TO_RAD = M_PI / 180.0; /* convert degrees to radians   */
 
@@ -199,6 +266,24 @@ camera_t cam;
 vec3_t urand[NRAN];
 int irand[NRAN];
 
+#define BVH_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 64
+int brute_force = 0;            /* test shadow rays against all spheres */
+bvh_t shadow_bvh[MAX_LIGHTS];   /* possible occluders of each light */
+shadow_stats_t shadow_total;    /* statistics of the whole frame */
+double min_weight = 0.01;       /* see shade() */
+int roulette = 0;               /* use Russian roulette below min_weight */
+long rays_total[MAX_RAY_DEPTH]; /* rays traced at each depth */
+long cut_total[MAX_RAY_DEPTH];  /* reflection rays not traced at each depth */
+
+/* The last sphere that occluded each light, and the statistics of
+   the calling thread */
+const sphere_t *last_occluder[MAX_LIGHTS];
+shadow_stats_t shadow_stats;
+long rays_by_depth[MAX_RAY_DEPTH], rays_cut[MAX_RAY_DEPTH];
+uint64_t rng_state;             /* seeded for each primary ray */
+#pragma omp threadprivate(last_occluder, shadow_stats, rays_by_depth, rays_cut, rng_state)
+
 const char *usage = {
     "\n"
     "Usage: omp-c-ray [options]\n\n"
@@ -209,6 +294,10 @@ const char *usage = {
     "  -r <rays>  shoot <rays> rays per pixel (antialiasing, default 1)\n"
     "  -i <file>  read from <file> instead of stdin\n"
     "  -o <file>  write to <file> instead of stdout\n"
+    "  -b         test shadow rays against all spheres (no BVH/caching)\n"
+    "  -e <eps>   do not trace reflections with weight below <eps> (default 0.01)\n"
+    "  -R         trace reflections with weight w < eps with probability w/eps\n"
+    "             (Russian roulette) instead of never\n"
     "  -h         this help screen\n\n"
 };
 
@@ -257,6 +346,16 @@ vec3_t cross_product(vec3_t v1, vec3_t v2)
 }
 
 
+/* Random number in [0, 1) from the per-thread xorshift64* generator */
+double rng_uniform( void )
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
 /* jitter function taken from Graphics Gems I. */
 vec3_t jitter(int x, int y, int s)
 {
@@ -379,11 +478,245 @@ ray_t get_primary_ray(int x, int y, int sample)
 }
 
 
+/* Extend the box [*lo, *hi] to include the sphere `sph` */
+void box_add_sphere(vec3_t *lo, vec3_t *hi, const sphere_t *sph)
+{
+    /* pad the box, so that rays grazing a sphere are not missed
+       because of rounding errors */
+    const double r = sph->rad + ERR_MARGIN;
+    lo->x = fmin(lo->x, sph->pos.x - r); hi->x = fmax(hi->x, sph->pos.x + r);
+    lo->y = fmin(lo->y, sph->pos.y - r); hi->y = fmax(hi->y, sph->pos.y + r);
+    lo->z = fmin(lo->z, sph->pos.z - r); hi->z = fmax(hi->z, sph->pos.z + r);
+}
+
+double coord(vec3_t v, int axis)
+{
+    return (axis == 0 ? v.x : (axis == 1 ? v.y : v.z));
+}
+
+/* Used by qsort() to sort the spheres along the axis `sort_axis` */
+int sort_axis;
+
+int compare_spheres(const void *p1, const void *p2)
+{
+    const double c1 = coord((*(const sphere_t**)p1)->pos, sort_axis);
+    const double c2 = coord((*(const sphere_t**)p2)->pos, sort_axis);
+    return (c1 > c2) - (c1 < c2);
+}
+
+/*
+ * Build the subtree rooted at bvh->nodes[idx] containing the spheres
+ * bvh->prims[first .. first+count-1]; the spheres are split in two
+ * halves along the longest axis of the bounding box of their
+ * centers. `next` is the index of the first unused node.
+ */
+void bvh_build(bvh_t *bvh, int idx, int first, int count, int *next)
+{
+    bvh_node_t *node = &bvh->nodes[idx];
+    vec3_t clo = {INFINITY, INFINITY, INFINITY}, chi = {-INFINITY, -INFINITY, -INFINITY};
+    int i;
+
+    node->lo = clo; node->hi = chi;
+    for (i=first; i<first+count; i++) {
+        const sphere_t *sph = bvh->prims[i];
+        box_add_sphere(&node->lo, &node->hi, sph);
+        clo.x = fmin(clo.x, sph->pos.x); chi.x = fmax(chi.x, sph->pos.x);
+        clo.y = fmin(clo.y, sph->pos.y); chi.y = fmax(chi.y, sph->pos.y);
+        clo.z = fmin(clo.z, sph->pos.z); chi.z = fmax(chi.z, sph->pos.z);
+    }
+    if (count <= BVH_LEAF_SIZE) {
+        node->first = first;
+        node->count = count;
+    } else {
+        const double ext[3] = {chi.x - clo.x, chi.y - clo.y, chi.z - clo.z};
+        sort_axis = (ext[0] >= ext[1] && ext[0] >= ext[2] ? 0 : (ext[1] >= ext[2] ? 1 : 2));
+        qsort(bvh->prims + first, count, sizeof(*bvh->prims), compare_spheres);
+        node->first = *next;
+        node->count = 0;
+        *next += 2;
+        bvh_build(bvh, node->first, first, count/2, next);
+        bvh_build(bvh, node->first + 1, first + count/2, count - count/2, next);
+    }
+}
+
+/* angular radius of sphere `sph` seen from a point at distance `d` */
+double angular_radius(const sphere_t *sph, double d)
+{
+    return asin(sph->rad / d);
+}
+
+/*
+ * Return nonzero iff the sphere `s` might hide some point of the
+ * sphere `t` from the light `l`: a segment from a point of `t` to
+ * the light that crosses `s` lies inside the cone from the light
+ * tangent to `s`, and the cone tangent to `t`, so the two cones must
+ * overlap; furthermore, the farthest point of `t` must be farther
+ * from the light than the nearest point of `s`.
+ */
+int may_occlude(const sphere_t *s, const sphere_t *t, vec3_t l)
+{
+    const double eps = 1e-9;
+    const vec3_t u = {s->pos.x - l.x, s->pos.y - l.y, s->pos.z - l.z};
+    const vec3_t v = {t->pos.x - l.x, t->pos.y - l.y, t->pos.z - l.z};
+    const double du = sqrt(dot(u, u)), dv = sqrt(dot(v, v));
+    double theta;
+
+    /* if the light is inside one of the spheres, be conservative */
+    if (du <= s->rad + ERR_MARGIN || dv <= t->rad + ERR_MARGIN)
+        return 1;
+    if (dv + t->rad < du - s->rad - ERR_MARGIN)
+        return 0;
+    theta = acos(fmax(-1.0, fmin(1.0, dot(u, v) / (du * dv))));
+    return theta <= angular_radius(s, du) + angular_radius(t, dv) + eps;
+}
+
+/*
+ * For each light, build the BVH of the spheres that might hide some
+ * other sphere from that light. A sphere can always hide part of
+ * itself; this case is handled separately by occluded(), which tests
+ * the shaded sphere first.
+ */
+void build_shadow_bvh( void )
+{
+    const sphere_t *s, *t;
+    int i, n = 0;
+
+    for (s = obj_list; s != NULL; s = s->next)
+        n++;
+
+    for (i=0; i<lnum; i++) {
+        bvh_t *bvh = &shadow_bvh[i];
+        int next = 1;
+
+        bvh->prims = malloc((n > 0 ? n : 1) * sizeof(*bvh->prims));
+        bvh->nodes = malloc((n > 0 ? 2*n : 1) * sizeof(*bvh->nodes));
+        assert(bvh->prims != NULL && bvh->nodes != NULL);
+        bvh->nprims = 0;
+        for (s = obj_list; s != NULL; s = s->next) {
+            for (t = obj_list; t != NULL; t = t->next) {
+                if (t != s && may_occlude(s, t, lights[i])) {
+                    bvh->prims[bvh->nprims++] = s;
+                    break;
+                }
+            }
+        }
+        bvh_build(bvh, 0, 0, bvh->nprims, &next);
+    }
+}
+
+void free_shadow_bvh( void )
+{
+    int i;
+
+    for (i=0; i<lnum; i++) {
+        free(shadow_bvh[i].prims);
+        free(shadow_bvh[i].nodes);
+    }
+}
+
+/*
+ * Return nonzero iff the segment orig + t*dir, 0 <= t <= 1, intersects
+ * the box [lo, hi]; `inv` contains the reciprocals of the components
+ * of dir. If a component of dir is zero, the corresponding products
+ * may be NaN, which fmin()/fmax() ignore.
+ */
+int segment_box(vec3_t lo, vec3_t hi, vec3_t orig, vec3_t inv)
+{
+    double t1, t2, tmin = 0.0, tmax = 1.0;
+
+    t1 = (lo.x - orig.x) * inv.x; t2 = (hi.x - orig.x) * inv.x;
+    tmin = fmax(tmin, fmin(t1, t2)); tmax = fmin(tmax, fmax(t1, t2));
+    t1 = (lo.y - orig.y) * inv.y; t2 = (hi.y - orig.y) * inv.y;
+    tmin = fmax(tmin, fmin(t1, t2)); tmax = fmin(tmax, fmax(t1, t2));
+    t1 = (lo.z - orig.z) * inv.z; t2 = (hi.z - orig.z) * inv.z;
+    tmin = fmax(tmin, fmin(t1, t2)); tmax = fmin(tmax, fmax(t1, t2));
+    return tmin <= tmax;
+}
+
+/*
+ * Return the first sphere of `bvh`, other than `skip1` and `skip2`
+ * (that have already been tested), that intersects the shadow ray
+ * `ray`, or NULL if there is none.
+ */
+const sphere_t *bvh_any_hit(const bvh_t *bvh, ray_t ray,
+                            const sphere_t *skip1, const sphere_t *skip2)
+{
+    int stack[BVH_MAX_DEPTH], top = 0, i;
+    const vec3_t inv = {1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z};
+
+    if (bvh->nprims == 0)
+        return NULL;
+
+    stack[top++] = 0;
+    while (top > 0) {
+        const bvh_node_t *node = &bvh->nodes[stack[--top]];
+        if (!segment_box(node->lo, node->hi, ray.orig, inv))
+            continue;
+        if (node->count > 0) {
+            for (i=node->first; i<node->first + node->count; i++) {
+                const sphere_t *sph = bvh->prims[i];
+                if (sph != skip1 && sph != skip2) {
+                    shadow_stats.tests++;
+                    if (ray_sphere(sph, ray, NULL))
+                        return sph;
+                }
+            }
+        } else {
+            assert(top + 2 <= BVH_MAX_DEPTH);
+            stack[top++] = node->first + 1;
+            stack[top++] = node->first;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Return nonzero iff the shadow ray `ray` from a point of the sphere
+ * `obj` towards light `l` is blocked by some sphere.
+ */
+int occluded(int l, const sphere_t *obj, ray_t ray)
+{
+    const sphere_t *cached = last_occluder[l], *hit;
+
+    shadow_stats.rays++;
+    if (brute_force) {
+        for (hit = obj_list; hit != NULL; hit = hit->next) {
+            shadow_stats.tests++;
+            if (ray_sphere(hit, ray, NULL))
+                return 1;
+        }
+        return 0;
+    }
+
+    shadow_stats.tests++;
+    if (ray_sphere(obj, ray, NULL)) {
+        shadow_stats.self_hits++;
+        return 1;
+    }
+    if (cached != NULL && cached != obj) {
+        shadow_stats.tests++;
+        if (ray_sphere(cached, ray, NULL)) {
+            shadow_stats.cache_hits++;
+            return 1;
+        }
+    }
+    hit = bvh_any_hit(&shadow_bvh[l], ray, obj, cached);
+    if (hit != NULL) {
+        last_occluder[l] = hit;
+        return 1;
+    }
+    return 0;
+}
+
+
 /*
  * Compute direct illumination with the phong reflectance model.  Also
- * handles reflections by calling trace again, if necessary.
+ * handles reflections by calling trace again, if necessary. `weight`
+ * is the product of the reflectivities of the surfaces that the ray
+ * has bounced on, i.e., the factor by which the color returned is
+ * multiplied in the final pixel.
  */
-vec3_t shade(sphere_t *obj, spoint_t *sp, int depth)
+vec3_t shade(sphere_t *obj, spoint_t *sp, int depth, double weight)
 {
     int i;
     vec3_t col = {0, 0, 0};
@@ -393,7 +726,6 @@ vec3_t shade(sphere_t *obj, spoint_t *sp, int depth)
         double ispec, idiff;
         vec3_t ldir;
         ray_t shadow_ray;
-        sphere_t *iter = obj_list;
         int in_shadow = 0;
 
         ldir.x = lights[i].x - sp->pos.x;
@@ -405,12 +737,7 @@ vec3_t shade(sphere_t *obj, spoint_t *sp, int depth)
 
         /* shoot shadow rays to determine if we have a line of sight
            with the light */
-        for (iter = obj_list;
-             (iter != NULL) && !ray_sphere(iter, shadow_ray, 0);
-             iter = iter->next) {
-            /* empty body */
-        }
-        in_shadow = (iter != NULL);
+        in_shadow = occluded(i, obj, shadow_ray);
         /* and if we're not in shadow, calculate direct illumination
            with the phong model. */
         if (!in_shadow) {
@@ -427,21 +754,37 @@ vec3_t shade(sphere_t *obj, spoint_t *sp, int depth)
 
     /* Also, if the object is reflective, spawn a reflection ray, and
        call trace() to calculate the light arriving from the mirror
-       direction. */
-    if (obj->mat.refl > 0.0) {
+       direction. A reflection ray whose weight is below min_weight
+       contributes little to the pixel and is not traced; with Russian
+       roulette, it is traced with probability weight / min_weight
+       and its color is scaled by the inverse of that probability, so
+       that the expected value of the pixel does not change. */
+    if (obj->mat.refl > 0.0 && depth + 1 < MAX_RAY_DEPTH) {
+        double rweight = weight * obj->mat.refl, scale = obj->mat.refl;
         ray_t ray;
         vec3_t rcol;
 
+        if (rweight < min_weight) {
+            const double p = rweight / min_weight;
+            if (roulette && rng_uniform() < p) {
+                scale /= p;
+                rweight = min_weight;
+            } else {
+                rays_cut[depth + 1]++;
+                return col;
+            }
+        }
+
         ray.orig = sp->pos;
         ray.dir = sp->vref;
         ray.dir.x *= RAY_MAG;
         ray.dir.y *= RAY_MAG;
         ray.dir.z *= RAY_MAG;
 
-        rcol = trace(ray, depth + 1);
-        col.x += rcol.x * obj->mat.refl;
-        col.y += rcol.y * obj->mat.refl;
-        col.z += rcol.z * obj->mat.refl;
+        rcol = trace(ray, depth + 1, rweight);
+        col.x += rcol.x * scale;
+        col.y += rcol.y * scale;
+        col.z += rcol.z * scale;
     }
 
     return col;
@@ -452,7 +795,7 @@ vec3_t shade(sphere_t *obj, spoint_t *sp, int depth)
  * trace a ray throught the scene recursively (the recursion happens
  * through shade() to calculate reflection rays if necessary).
  */
-vec3_t trace(ray_t ray, int depth)
+vec3_t trace(ray_t ray, int depth, double weight)
 {
     vec3_t col;
     spoint_t sp, nearest_sp;
@@ -466,6 +809,7 @@ vec3_t trace(ray_t ray, int depth)
         col.x = col.y = col.z = 0.0;
         return col;
     }
+    rays_by_depth[depth]++;
 
     /* find the nearest intersection ... */
     for (iter = obj_list; iter != NULL; iter = iter->next ) {
@@ -478,7 +822,7 @@ vec3_t trace(ray_t ray, int depth)
 
     /* and perform shading calculations as needed by calling shade() */
     if (nearest_obj != NULL) {
-        col = shade(nearest_obj, &nearest_sp, depth);
+        col = shade(nearest_obj, &nearest_sp, depth, weight);
     } else {
         col.x = col.y = col.z = 0.0;
     }
@@ -497,7 +841,13 @@ void render(int xsz, int ysz, pixel_t *fb, int samples)
      * the colors of the subpixels of each pixel, then put the colors
      * into the framebuffer.
      */
-#pragma omp parallel for default(none) collapse(2) shared(fb, samples, xsz, ysz)
+#pragma omp parallel default(none) private(i, j) shared(fb, samples, xsz, ysz, shadow_total, rays_total, cut_total, lnum)
+    {
+    for (i=0; i<lnum; i++) last_occluder[i] = NULL;
+    memset(&shadow_stats, 0, sizeof(shadow_stats));
+    memset(rays_by_depth, 0, sizeof(rays_by_depth));
+    memset(rays_cut, 0, sizeof(rays_cut));
+#pragma omp for collapse(2)
     for (j=0; j<ysz; j++) {
         for (i=0; i<xsz; i++) {
             double r, g, b;
@@ -505,7 +855,12 @@ void render(int xsz, int ysz, pixel_t *fb, int samples)
             r = g = b = 0.0;
 
             for (s=0; s<samples; s++) {
-                vec3_t col = trace(get_primary_ray(i, j, s), 0);
+                vec3_t col;
+                /* seed the generator with the index of the primary
+                   ray, so that the image does not depend on the
+                   number of threads */
+                rng_state = 0x9E3779B97F4A7C15ULL * ((uint64_t)(j*xsz + i) * samples + s + 1);
+                col = trace(get_primary_ray(i, j, s), 0, 1.0);
                 r += col.x;
                 g += col.y;
                 b += col.z;
@@ -520,6 +875,18 @@ void render(int xsz, int ysz, pixel_t *fb, int samples)
             fb[j*xsz+i].b = (uint8_t)(fmin(b, 1.0) * 255.0);
         }
     }
+#pragma omp critical
+    {
+        shadow_total.rays += shadow_stats.rays;
+        shadow_total.tests += shadow_stats.tests;
+        shadow_total.self_hits += shadow_stats.self_hits;
+        shadow_total.cache_hits += shadow_stats.cache_hits;
+        for (i=0; i<MAX_RAY_DEPTH; i++) {
+            rays_total[i] += rays_by_depth[i];
+            cut_total[i] += rays_cut[i];
+        }
+    }
+    }
 }
 
 /* Load the scene from an extremely simple scene description file */
@@ -640,6 +1007,21 @@ int main(int argc, char *argv[])
                 rays_per_pixel = atoi(argv[i]);
                 break;
 
+            case 'b':
+                brute_force = 1;
+                break;
+
+            case 'e':
+                if ((min_weight = atof(argv[++i])) < 0.0) {
+                    fputs("-e must be followed by a nonnegative number\n", stderr);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'R':
+                roulette = 1;
+                break;
+
             case 'h':
                 fputs(usage, stdout);
                 return EXIT_SUCCESS;
@@ -661,6 +1043,7 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
     load_scene(infile);
+    build_shadow_bvh();
 
     /* initialize the random number tables for the jitter */
     for (i=0; i<NRAN; i++) urand[i].x = (double)rand() / RAND_MAX - 0.5;
@@ -673,6 +1056,19 @@ int main(int argc, char *argv[])
 
     /* output statistics to stderr */
     fprintf(stderr, "Rendering took %f seconds\n", elapsed);
+    fprintf(stderr, "Shadow rays: %ld, ray-sphere tests per shadow ray: %.2f\n",
+            shadow_total.rays, (double)shadow_total.tests / (shadow_total.rays > 0 ? shadow_total.rays : 1));
+    if (!brute_force) {
+        long noccl = 0;
+        for (i=0; i<lnum; i++) noccl += shadow_bvh[i].nprims;
+        fprintf(stderr, "Blocked by the shaded sphere: %ld, by the cached occluder: %ld\n",
+                shadow_total.self_hits, shadow_total.cache_hits);
+        fprintf(stderr, "Possible occluders per light: %.1f\n", (double)noccl / (lnum > 0 ? lnum : 1));
+    }
+    fprintf(stderr, "Depth   Rays traced  Reflections not traced\n");
+    for (i=0; i<MAX_RAY_DEPTH; i++) {
+        fprintf(stderr, "%5d  %12ld  %12ld\n", i, rays_total[i], cut_total[i]);
+    }
 
     /* output the image */
     fprintf(outfile, "P6\n%d %d\n255\n", xres, yres);
@@ -680,6 +1076,7 @@ int main(int argc, char *argv[])
     fflush(outfile);
 
     free(pixels);
+    free_shadow_bvh( );
     free_scene( );
 
     if (infile != stdin) fclose(infile);
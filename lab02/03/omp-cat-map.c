@@ -260,6 +260,7 @@ that they tend to align along straight lines.
 #include <string.h>
 #include <assert.h>
 #include <omp.h>
+#include <sched.h>
 
 typedef struct {
     int width;   /* Width of the image (in pixels) */
@@ -416,10 +417,114 @@ void cat_map( PGM_image* img, int k )
     free(next);
 }
 
+/* cat_map() enters a new parallel region at each of the `k`
+   iterations. cat_map_persistent() creates the pool of threads only
+   once: each thread always reads the same block of rows of the
+   source image, and all threads synchronize with the sense-reversing
+   barrier below before the two bitmaps are exchanged. */
+
+/* Centralized sense-reversing barrier (see omp-loop.c). Waiting
+   threads busy-wait for SR_SPIN iterations, then yield the processor
+   at each check. */
+typedef struct {
+    int count;    /* number of threads that reached the barrier */
+    int sense;    /* global sense, flipped when all threads arrive */
+    int nthreads; /* number of threads that must synchronize */
+} sr_barrier_t;
+
+#define SR_SPIN 1000
+
+void sr_barrier_init( sr_barrier_t *b, int nthreads )
+{
+    b->count = 0;
+    b->sense = 0;
+    b->nthreads = nthreads;
+}
+
+/**
+ * Wait on barrier `b`; `local_sense` points to a private variable of
+ * the calling thread, initialized to zero before the first use.
+ */
+void sr_barrier_wait( sr_barrier_t *b, int *local_sense )
+{
+    int arrived, cur, spin = 0;
+
+    *local_sense = !*local_sense;
+#pragma omp atomic capture seq_cst
+    arrived = ++(b->count);
+    if (arrived == b->nthreads) {
+#pragma omp atomic write seq_cst
+        b->count = 0;
+#pragma omp atomic write seq_cst
+        b->sense = *local_sense;
+    } else {
+        do {
+#pragma omp atomic read seq_cst
+            cur = b->sense;
+            if (++spin > SR_SPIN)
+                sched_yield();
+        } while (cur != *local_sense);
+    }
+}
+
+/**
+ * Same as cat_map(), using a single parallel region for all the `k`
+ * iterations.
+ */
+void cat_map_persistent( PGM_image* img, int k )
+{
+    const int N = img->width;
+    unsigned char *bmap = img->bmap;
+    unsigned char *tmp = (unsigned char*)malloc( N*N*sizeof(unsigned char) );
+    sr_barrier_t bar;
+
+    assert(tmp != NULL);
+    assert(img->width == img->height);
+
+#pragma omp parallel default(none) shared(N, k, bmap, tmp, bar)
+    {
+        const int num_threads = omp_get_num_threads();
+        const int my_id = omp_get_thread_num();
+        const int my_start = my_id * N / num_threads;
+        const int my_end = (my_id + 1) * N / num_threads;
+        unsigned char *cur = bmap;
+        unsigned char *next = tmp;
+        unsigned char *swap;
+        int sense = 0;
+
+#pragma omp single
+        sr_barrier_init(&bar, num_threads);
+
+        for (int i=0; i<k; i++) {
+            for (int y=my_start; y<my_end; y++) {
+                for (int x=0; x<N; x++) {
+                    const int xnext = (2*x+y) % N;
+                    const int ynext = (x + y) % N;
+                    next[xnext + ynext*N] = cur[x+y*N];
+                }
+            }
+            /* every thread must have completed the new image before
+               anyone starts reading from it */
+            sr_barrier_wait(&bar, &sense);
+            swap = cur;
+            cur = next;
+            next = swap;
+        }
+    }
+    /* After an odd number of iterations the result is in `tmp` */
+    if (k % 2) {
+        img->bmap = tmp;
+        free(bmap);
+    } else {
+        free(tmp);
+    }
+}
+
 
 int main( int argc, char* argv[] )
 {
-    PGM_image img;
+    PGM_image img, img2;
+    unsigned char *orig;
     int niter;
     double tstart, elapsed;
 
@@ -435,6 +540,11 @@ int main( int argc, char* argv[] )
         return EXIT_FAILURE;
     }
 
+    /* Keep a copy of the input for cat_map_persistent() */
+    orig = (unsigned char*)malloc(img.width*img.height);
+    assert(orig != NULL);
+    memcpy(orig, img.bmap, img.width*img.height);
+
     tstart = omp_get_wtime();
     cat_map(&img, niter);
     elapsed = omp_get_wtime() - tstart;
@@ -444,8 +554,31 @@ int main( int argc, char* argv[] )
     fprintf(stderr, "    width,height : %d,%d\n", img.width, img.height);
     fprintf(stderr, "     Mpixels/sec : %f\n", 1.0e-6 * img.width * img.height * niter / elapsed);
     fprintf(stderr, "Elapsed time (s) : %f\n", elapsed);
+
+    /* Same computation with a single parallel region; the result
+       must be identical */
+    img2.width = img2.height = img.width;
+    img2.maxgrey = img.maxgrey;
+    img2.bmap = (unsigned char*)malloc(img.width*img.height);
+    assert(img2.bmap != NULL);
+    memcpy(img2.bmap, orig, img.width*img.height);
+    tstart = omp_get_wtime();
+    cat_map_persistent(&img2, niter);
+    elapsed = omp_get_wtime() - tstart;
+    fprintf(stderr, "\n=== Persistent team of threads ===\n");
+    fprintf(stderr, "  OpenMP threads : %d\n", omp_get_max_threads());
+    fprintf(stderr, "      Iterations : %d\n", niter);
+    fprintf(stderr, "    width,height : %d,%d\n", img2.width, img2.height);
+    fprintf(stderr, "     Mpixels/sec : %f\n", 1.0e-6 * img2.width * img2.height * niter / elapsed);
+    fprintf(stderr, "Elapsed time (s) : %f\n", elapsed);
+    fprintf(stderr, "     Same result : %s\n",
+            0 == memcmp(img.bmap, img2.bmap, img.width*img.height) ? "yes" : "NO");
+
     write_pgm(stdout, &img, "produced by omp-cat-map.c");
 
+    free(orig);
+    free_pgm( &img2 );
+
     free_pgm( &img );
     return EXIT_SUCCESS;
 }
@@ -47,8 +47,12 @@ To execute:
 
 ***/
 
+#if _XOPEN_SOURCE < 600
+#define _XOPEN_SOURCE 600
+#endif
 #include <assert.h>
 #include <omp.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -158,6 +162,85 @@ void vec_shift_right_par2(int *a, int n) {
   }
 }
 
+/* vec_shift_right_par1() and vec_shift_right_par2() only shift by
+   one position, and the former requires a temporary array of length
+   n. The functions below rotate an array to the right by an
+   arbitrary number of positions |k|, in place, using the
+   "three-reversal" algorithm:
+
+   rotate_right(a, k) = reverse(reverse(a[0..n-k-1]) reverse(a[n-k..n-1]))
+
+   that we implement as: reverse the whole array, then reverse
+   separately the first k and the last n-k elements. Each element is
+   read and written exactly twice, and no extra space is needed. */
+
+/**
+ * Reverse the elements a[lo], ..., a[hi-1]. This function contains
+ * an orphaned worksharing loop and must be called by all threads of
+ * a parallel region (or outside any parallel region).
+ *
+ * The pairs (a[i], a[hi-1-(i-lo)]) are disjoint, therefore the swaps
+ * are independent. The "simd" clause allows the compiler to load a
+ * block of elements from each end, reverse the lanes with a shuffle
+ * and store them at the opposite end, which it would not do by
+ * itself since it can not prove that the two ends do not overlap.
+ */
+void vec_reverse_range(int *a, int lo, int hi) {
+  const int half = (hi - lo) / 2;
+  int *left = a + lo;
+  int *right = a + hi - 1;
+
+#pragma omp for simd schedule(static)
+  for (int i = 0; i < half; i++) {
+    const int tmp = left[i];
+    left[i] = right[-i];
+    right[-i] = tmp;
+  }
+}
+
+/**
+ * Reverse the array |a| of length |n| in place.
+ */
+void vec_reverse_par(int *a, int n) {
+#pragma omp parallel default(none) shared(a, n)
+  vec_reverse_range(a, 0, n);
+}
+
+/**
+ * Rotate the elements of array |a| of length |n| |k| positions to
+ * the right; |k| can be any nonnegative integer. Element a[i] moves
+ * to position (i + k) % n.
+ */
+void vec_rotate_right_par(int *a, int n, int k) {
+  if (n <= 1) {
+    return;
+  }
+  k = k % n;
+  if (k == 0) {
+    return;
+  }
+  /* The three reversals are separated by the implicit barrier at the
+     end of each worksharing loop. */
+#pragma omp parallel default(none) shared(a, n, k)
+  {
+    vec_reverse_range(a, 0, n);
+    vec_reverse_range(a, 0, k);
+    vec_reverse_range(a, k, n);
+  }
+}
+
+/* Serial reference for vec_rotate_right_par(), using a temporary
+   array */
+void vec_rotate_right_seq(int *a, int n, int k) {
+  int *b = (int *)malloc(n * sizeof(int));
+  assert(b != NULL);
+  for (int i = 0; i < n; i++) {
+    b[(i + k) % n] = a[i];
+  }
+  memcpy(a, b, n * sizeof(int));
+  free(b);
+}
+
 /****************************************************************************/
 
 /* This function converts 2D indexes into a linear index; n is the
@@ -201,6 +284,89 @@ void test1_par(int *A, int n) {
 
 }
 
+/* test1_par() opens a new parallel region for each of the n rows of
+   A[][], and the cost of waking up the pool of threads is paid n
+   times. test1_par_persistent() creates the pool once: each thread
+   owns the same block of columns for all rows (so that it always
+   touches the same memory, which is good for caches and NUMA nodes),
+   and the threads synchronize after each row using the
+   sense-reversing barrier below. */
+
+/* Centralized sense-reversing barrier. The last thread that arrives
+   resets the counter and flips the shared |sense|; the other threads
+   spin until |sense| matches their own local sense, that is flipped
+   by each thread at every barrier. Since the local sense alternates,
+   the barrier can be reused immediately without a second
+   synchronization to reset the counter. Waiting threads busy-wait
+   for SR_SPIN iterations, then yield the processor at each check, so
+   that the barrier does not collapse when there are more threads
+   than cores. */
+
+#define SR_SPIN 1000
+
+typedef struct {
+  int count;    /* number of threads that reached the barrier */
+  int sense;    /* global sense, flipped when all threads arrive */
+  int nthreads; /* number of threads that must synchronize */
+} sr_barrier_t;
+
+void sr_barrier_init(sr_barrier_t *b, int nthreads) {
+  b->count = 0;
+  b->sense = 0;
+  b->nthreads = nthreads;
+}
+
+/**
+ * Wait on barrier |b|; |local_sense| points to a private variable of
+ * the calling thread, initialized to zero before the first use.
+ */
+void sr_barrier_wait(sr_barrier_t *b, int *local_sense) {
+  int arrived, cur, spin = 0;
+
+  *local_sense = !*local_sense;
+#pragma omp atomic capture seq_cst
+  arrived = ++(b->count);
+  if (arrived == b->nthreads) {
+#pragma omp atomic write seq_cst
+    b->count = 0;
+#pragma omp atomic write seq_cst
+    b->sense = *local_sense;
+  } else {
+    do {
+#pragma omp atomic read seq_cst
+      cur = b->sense;
+      if (++spin > SR_SPIN) {
+        sched_yield();
+      }
+    } while (cur != *local_sense);
+  }
+}
+
+void test1_par_persistent(int *A, int n) {
+  sr_barrier_t bar;
+
+#pragma omp parallel default(none) shared(A, n, bar)
+  {
+    const int num_threads = omp_get_num_threads();
+    const int my_id = omp_get_thread_num();
+    /* columns 1 .. n-2 are partitioned among the threads */
+    const int my_start = 1 + my_id * (n - 2) / num_threads;
+    const int my_end = 1 + (my_id + 1) * (n - 2) / num_threads;
+    int sense = 0;
+
+#pragma omp single
+    sr_barrier_init(&bar, num_threads);
+
+    for (int i = 1; i < n; i++) {
+      for (int j = my_start; j < my_end; j++) {
+        A[IDX(i, j, n)] = f(A[IDX(i - 1, j - 1, n)], A[IDX(i - 1, j, n)],
+                            A[IDX(i - 1, j + 1, n)]);
+      }
+      sr_barrier_wait(&bar, &sense);
+    }
+  }
+}
+
 /****************************************************************************/
 
 void test2_seq(int *A, int n) {
@@ -290,6 +456,92 @@ void test3_par(int *A, int n) {
   }
 }
 
+/****************************************************************************/
+
+/* Tiled wavefront engine for 2-D recurrences where A[i][j] depends
+   on (a subset of) A[i][j-1], A[i-1][j-1] and A[i-1][j], e.g.,
+   test2_seq() and test3_seq() above, or dynamic-programming tables
+   such as edit distance.
+
+   Sweeping by anti-diagonals of single elements (as in test3_par())
+   requires one parallel region per diagonal, and each diagonal visits
+   elements that are n-1 positions apart in memory. Here the matrix
+   is instead partitioned into square tiles of TILE x TILE elements
+   (TILE*TILE*sizeof(int) fits comfortably in L1/L2). Tile (ti, tj)
+   can be computed as soon as tiles (ti-1, tj) and (ti, tj-1) are
+   done; tile (ti-1, tj-1) is then done as well, by transitivity. Each
+   tile is an OpenMP task whose dependences are expressed on the
+   elements of a dummy array dep[][] (one element per tile), so that
+   the whole matrix is processed inside a single parallel region and
+   the runtime starts a tile as soon as its neighbors are done, with
+   no global barrier between diagonals.
+
+   Inside a tile the kernel sweeps rows top to bottom and columns
+   left to right, i.e., in the same order as the serial code, so
+   that any recurrence that is correct for the serial loop is also
+   correct for the tiled version. */
+
+#define TILE 64
+
+/* A tile kernel computes all elements A[i][j] with i0 <= i < i1 and
+   j0 <= j < j1 of the nxn matrix A, in row-major order. */
+typedef void (*tile_kernel_t)(int *A, int n, int i0, int i1, int j0, int j1);
+
+/**
+ * Apply the tile kernel |kernel| to all elements A[i][j] of the nxn
+ * matrix |A| with 1 <= i < n and 1 <= j < n, respecting the
+ * dependences of a recurrence that reads only from the west,
+ * north-west and north neighbors of each element.
+ */
+void wavefront(int *A, int n, tile_kernel_t kernel) {
+  const int nt = (n - 1 + TILE - 1) / TILE; /* tiles per side */
+  char *dep = (char *)malloc(nt * nt);
+  assert(dep != NULL);
+
+#pragma omp parallel default(none) shared(A, n, kernel, dep, nt)
+#pragma omp single
+  for (int ti = 0; ti < nt; ti++) {
+    for (int tj = 0; tj < nt; tj++) {
+      /* Tiles on the first row/column depend on a "virtual" tile;
+         we make them depend on themselves, which is harmless. */
+      const int north = ti > 0 ? IDX(ti - 1, tj, nt) : IDX(ti, tj, nt);
+      const int west = tj > 0 ? IDX(ti, tj - 1, nt) : IDX(ti, tj, nt);
+#pragma omp task firstprivate(ti, tj, north, west)                            \
+    depend(in : dep[north], dep[west]) depend(out : dep[IDX(ti, tj, nt)])
+      {
+        const int i0 = 1 + ti * TILE;
+        const int j0 = 1 + tj * TILE;
+        const int i1 = i0 + TILE < n ? i0 + TILE : n;
+        const int j1 = j0 + TILE < n ? j0 + TILE : n;
+        kernel(A, n, i0, i1, j0, j1);
+      }
+    }
+  }
+
+  free(dep);
+}
+
+void test2_tile(int *A, int n, int i0, int i1, int j0, int j1) {
+  for (int i = i0; i < i1; i++) {
+    for (int j = j0; j < j1; j++) {
+      A[IDX(i, j, n)] = g(A[IDX(i, j - 1, n)], A[IDX(i - 1, j - 1, n)]);
+    }
+  }
+}
+
+void test3_tile(int *A, int n, int i0, int i1, int j0, int j1) {
+  for (int i = i0; i < i1; i++) {
+    for (int j = j0; j < j1; j++) {
+      A[IDX(i, j, n)] =
+          f(A[IDX(i, j - 1, n)], A[IDX(i - 1, j - 1, n)], A[IDX(i - 1, j, n)]);
+    }
+  }
+}
+
+void test2_par_tiled(int *A, int n) { wavefront(A, n, test2_tile); }
+
+void test3_par_tiled(int *A, int n) { wavefront(A, n, test3_tile); }
+
 /**
  ** The code below does not need to be modified
  **/
@@ -351,6 +603,32 @@ int main(void) {
     printf("FAILED\n");
   }
 
+  printf("vec_rotate_right_par()\t");
+  fflush(stdout);
+  fill(a1, N);
+  vec_shift_right_seq(a1, N);
+  fill(a2, N);
+  vec_rotate_right_par(a2, N, 1);
+  {
+    int ok = array_equal(a1, a2, N);
+    /* some shifts larger than one, including k > n */
+    const int ks[] = {0, 7, N / 3, N - 1, N, 5 * N + 3};
+    for (int t = 0; t < (int)(sizeof(ks) / sizeof(ks[0])); t++) {
+      fill(a1, N);
+      vec_rotate_right_seq(a1, N, ks[t]);
+      fill(a2, N);
+      vec_rotate_right_par(a2, N, ks[t]);
+      ok = ok && array_equal(a1, a2, N);
+    }
+    /* odd length, so that the reversals have a middle element */
+    fill(a1, N - 1);
+    vec_rotate_right_seq(a1, N - 1, 100);
+    fill(a2, N - 1);
+    vec_rotate_right_par(a2, N - 1, 100);
+    ok = ok && array_equal(a1, a2, N - 1);
+    printf("%s\n", ok ? "OK" : "FAILED");
+  }
+
   /* test1 */
   printf("test1_par()\t\t");
   fflush(stdout);
@@ -364,6 +642,17 @@ int main(void) {
     printf("FAILED\n");
   }
 
+  /* test1, persistent team of threads */
+  printf("test1_par_persistent()\t");
+  fflush(stdout);
+  fill(a2, N * N);
+  test1_par_persistent(a2, N);
+  if (array_equal(a1, a2, N * N)) {
+    printf("OK\n");
+  } else {
+    printf("FAILED\n");
+  }
+
   /* test2 */
   printf("test2_par()\t\t");
   fflush(stdout);
@@ -390,6 +679,79 @@ int main(void) {
     printf("FAILED\n");
   }
 
+  /* test2, tiled wavefront */
+  printf("test2_par_tiled()\t");
+  fflush(stdout);
+  fill(a1, N * N);
+  test2_seq(a1, N);
+  fill(a2, N * N);
+  test2_par_tiled(a2, N);
+  if (array_equal(a1, a2, N * N)) {
+    printf("OK\n");
+  } else {
+    printf("FAILED\n");
+  }
+
+  /* test3, tiled wavefront */
+  printf("test3_par_tiled()\t");
+  fflush(stdout);
+  fill(a1, N * N);
+  test3_seq(a1, N);
+  fill(a2, N * N);
+  test3_par_tiled(a2, N);
+  if (array_equal(a1, a2, N * N)) {
+    printf("OK\n");
+  } else {
+    printf("FAILED\n");
+  }
+
+  /* Compare one parallel region per row against a persistent team
+     of threads on test1; the per-row work is small, so that the
+     overhead of the parallel regions is clearly visible. */
+  {
+    const int NREP = 10;
+    double tstart, t_forkjoin, t_persistent;
+
+    fill(a2, N * N);
+    tstart = omp_get_wtime();
+    for (int r = 0; r < NREP; r++) {
+      test1_par(a2, N);
+    }
+    t_forkjoin = (omp_get_wtime() - tstart) / NREP;
+
+    fill(a2, N * N);
+    tstart = omp_get_wtime();
+    for (int r = 0; r < NREP; r++) {
+      test1_par_persistent(a2, N);
+    }
+    t_persistent = (omp_get_wtime() - tstart) / NREP;
+
+    printf("\ntest1 (%d threads, n=%d):\n", omp_get_max_threads(), N);
+    printf("  fork/join per row : %f s\n", t_forkjoin);
+    printf("  persistent team   : %f s\n", t_persistent);
+  }
+
+  /* Effective bandwidth of the in-place rotation on a large array:
+     the three reversals read and write each element twice. We use
+     a1, that holds N*N elements. */
+  {
+    const int NREP = 10;
+    const int len = N * N;
+    double tstart, elapsed;
+
+    fill(a1, len);
+    tstart = omp_get_wtime();
+    for (int r = 0; r < NREP; r++) {
+      vec_rotate_right_par(a1, len, len / 3 + r);
+    }
+    elapsed = (omp_get_wtime() - tstart) / NREP;
+    printf("\nvec_rotate_right_par() (%d threads, n=%d):\n",
+           omp_get_max_threads(), len);
+    printf("  time      : %f s\n", elapsed);
+    printf("  bandwidth : %f GB/s\n",
+           4.0 * len * sizeof(int) / elapsed / 1e9);
+  }
+
   free(a1);
   free(b1);
   free(c1);
@@ -0,0 +1,287 @@
+/****************************************************************************
+ *
+ * mpi-mapreduce.h - Distributed map-reduce with MPI and OpenMP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * --------------------------------------------------------------------------
+ *
+ * This header file provides a function mr_mapreduce() that reduces
+ * the elements 0 .. n-1 of a "virtual" array that is never stored
+ * as a whole: each MPI process is assigned a contiguous block of
+ * indices (blocks differ in length by at most one element, for any n
+ * and any number of processes), and produces its elements itself,
+ * e.g., by computing or reading them. No process needs to hold the
+ * whole input, and no scatter from a root process is needed.
+ *
+ * A reduction is described by a mr_reducer_t object:
+ *
+ * - `size`: size in bytes of a partial result;
+ *
+ * - `init(acc)`: set `*acc` to the neutral element;
+ *
+ * - `map(lo, hi, acc, arg)`: produce the elements with (global)
+ *   indices lo, ..., hi-1 and accumulate them into `*acc`; hi-lo is
+ *   at most MR_BLOCK, so that the elements can be generated into a
+ *   small buffer that stays in cache, and reduced with SIMD
+ *   instructions (see mr_sum_pairwise());
+ *
+ * - `combine(inout, in)`: accumulate the partial result `*in` into
+ *   `*inout`; the operation must be associative and commutative.
+ *
+ * Each process splits its block among its OpenMP threads; the
+ * partial results of the threads are combined in thread order, and
+ * those of the processes with MPI_Reduce() or MPI_Allreduce() using
+ * an operator created from `combine`.
+ *
+ * Predefined partial results (with the corresponding init/combine
+ * functions) are provided for compensated sums (mr_ksum_t), min/max
+ * (mr_minmax_t) and 2-D bounding boxes (mr_bbox_t).
+ *
+ * The program must be compiled with -fopenmp; without it, each
+ * process uses a single thread.
+ *
+ ****************************************************************************/
+
+#ifndef MPI_MAPREDUCE_H
+#define MPI_MAPREDUCE_H
+
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <assert.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum number of elements passed to a single call of map() */
+#define MR_BLOCK 4096
+
+typedef struct {
+    size_t size;
+    void (*init)( void *acc );
+    void (*map)( long lo, long hi, void *acc, void *arg );
+    void (*combine)( void *inout, const void *in );
+} mr_reducer_t;
+
+/**
+ * Compute the block of indices assigned to process `rank` out of
+ * `size` processes: elements `*start` .. `*start + *count - 1`.
+ */
+void mr_partition( long n, int rank, int size, long *start, long *count )
+{
+    const long my_start = n * rank / size;
+    const long my_end = n * (rank + 1) / size;
+    *start = my_start;
+    *count = my_end - my_start;
+}
+
+/* The reducer of the current call of mr_mapreduce(); user-defined MPI
+   operators have no "context" argument, so we need a global */
+static const mr_reducer_t *mr_current = NULL;
+
+void mr_mpi_op( void *in, void *inout, int *len, MPI_Datatype *datatype )
+{
+    const size_t sz = mr_current->size;
+    for (int i=0; i<*len; i++) {
+        mr_current->combine((char*)inout + i*sz, (const char*)in + i*sz);
+    }
+}
+
+/**
+ * Reduce the elements 0 .. n-1 described by `r` over all processes
+ * of `comm`; `arg` is passed unchanged to r->map(). If `root` is a
+ * valid rank, the result is stored into `result` of process `root`
+ * only; if `root` is negative, the result is stored into `result` of
+ * all processes.
+ */
+void mr_mapreduce( const mr_reducer_t *r, long n, void *arg, void *result, int root, MPI_Comm comm )
+{
+    int my_rank, comm_sz, nthreads = 1, nteam = 1;
+    long start, count;
+    MPI_Datatype acc_type;
+    MPI_Op op;
+
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &comm_sz);
+    mr_partition(n, my_rank, comm_sz, &start, &count);
+
+#ifdef _OPENMP
+    /* Upper bound on the size of the team; the team actually created
+       may be smaller (e.g., with OMP_DYNAMIC, or inside another
+       parallel region), so the data are split among the threads that
+       are actually present */
+    nthreads = omp_get_max_threads();
+#endif
+    char *acc = (char*)malloc(nthreads * r->size);
+    char *local = (char*)malloc(r->size);
+    assert(acc != NULL && local != NULL);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthreads) default(none) shared(r, arg, acc, start, count, nteam)
+#endif
+    {
+#ifdef _OPENMP
+        const int my_id = omp_get_thread_num();
+        const int P = omp_get_num_threads();
+#pragma omp single nowait
+        nteam = P;
+#else
+        const int my_id = 0, P = 1;
+#endif
+        const long lo = start + count * my_id / P;
+        const long hi = start + count * (my_id + 1) / P;
+        char *my_acc = acc + my_id * r->size;
+
+        r->init(my_acc);
+        for (long b = lo; b < hi; b += MR_BLOCK) {
+            r->map(b, (hi - b < MR_BLOCK ? hi : b + MR_BLOCK), my_acc, arg);
+        }
+    }
+
+    /* Combining in thread order makes the result reproducible for a
+       given number of threads */
+    r->init(local);
+    for (int t=0; t<nteam; t++) {
+        r->combine(local, acc + t * r->size);
+    }
+
+    MPI_Type_contiguous((int)r->size, MPI_BYTE, &acc_type);
+    MPI_Type_commit(&acc_type);
+    MPI_Op_create(mr_mpi_op, 1, &op);
+    mr_current = r;
+    if (root >= 0) {
+        MPI_Reduce(local, result, 1, acc_type, op, root, comm);
+    } else {
+        MPI_Allreduce(local, result, 1, acc_type, op, comm);
+    }
+    mr_current = NULL;
+    MPI_Op_free(&op);
+    MPI_Type_free(&acc_type);
+
+    free(acc);
+    free(local);
+}
+
+/******************************************************************************
+ * Building blocks for map() functions
+ ******************************************************************************/
+
+/**
+ * Sum of the `n` elements of `v` by pairwise (cascade) summation:
+ * the rounding error grows as O(log n) instead of O(n) as in the
+ * obvious loop. Short ranges are summed with a SIMD reduction.
+ */
+float mr_sum_pairwise( const float *v, long n )
+{
+    if (n <= 128) {
+        float s = 0.0f;
+#pragma omp simd reduction(+:s)
+        for (long i=0; i<n; i++) {
+            s += v[i];
+        }
+        return s;
+    } else {
+        const long half = n / 2;
+        return mr_sum_pairwise(v, half) + mr_sum_pairwise(v + half, n - half);
+    }
+}
+
+/* Compensated (Kahan) sum: the value represented is sum - c */
+typedef struct {
+    float sum;
+    float c;
+} mr_ksum_t;
+
+void mr_ksum_init( void *acc )
+{
+    mr_ksum_t *k = (mr_ksum_t*)acc;
+    k->sum = k->c = 0.0f;
+}
+
+/* Add `x` to the compensated sum `*k` */
+void mr_ksum_add( mr_ksum_t *k, float x )
+{
+    /* volatile prevents -ffast-math from simplifying the compensation
+       away */
+    volatile float y = x - k->c;
+    volatile float t = k->sum + y;
+    k->c = (t - k->sum) - y;
+    k->sum = t;
+}
+
+void mr_ksum_combine( void *inout, const void *in )
+{
+    const mr_ksum_t *k = (const mr_ksum_t*)in;
+    mr_ksum_add((mr_ksum_t*)inout, k->sum);
+    mr_ksum_add((mr_ksum_t*)inout, -k->c);
+}
+
+typedef struct {
+    float min;
+    float max;
+} mr_minmax_t;
+
+void mr_minmax_init( void *acc )
+{
+    mr_minmax_t *m = (mr_minmax_t*)acc;
+    m->min = FLT_MAX;
+    m->max = -FLT_MAX;
+}
+
+/* Accumulate the `n` elements of `v` into `*m` */
+void mr_minmax_add( mr_minmax_t *m, const float *v, long n )
+{
+    float lo = m->min, hi = m->max;
+#pragma omp simd reduction(min:lo) reduction(max:hi)
+    for (long i=0; i<n; i++) {
+        lo = (v[i] < lo ? v[i] : lo);
+        hi = (v[i] > hi ? v[i] : hi);
+    }
+    m->min = lo;
+    m->max = hi;
+}
+
+void mr_minmax_combine( void *inout, const void *in )
+{
+    mr_minmax_t *a = (mr_minmax_t*)inout;
+    const mr_minmax_t *b = (const mr_minmax_t*)in;
+    a->min = (b->min < a->min ? b->min : a->min);
+    a->max = (b->max > a->max ? b->max : a->max);
+}
+
+/* Bounding box of a set of points or rectangles */
+typedef struct {
+    float xmin, ymin;
+    float xmax, ymax;
+} mr_bbox_t;
+
+void mr_bbox_init( void *acc )
+{
+    mr_bbox_t *b = (mr_bbox_t*)acc;
+    b->xmin = b->ymin = FLT_MAX;
+    b->xmax = b->ymax = -FLT_MAX;
+}
+
+void mr_bbox_combine( void *inout, const void *in )
+{
+    mr_bbox_t *a = (mr_bbox_t*)inout;
+    const mr_bbox_t *b = (const mr_bbox_t*)in;
+    a->xmin = (b->xmin < a->xmin ? b->xmin : a->xmin);
+    a->ymin = (b->ymin < a->ymin ? b->ymin : a->ymin);
+    a->xmax = (b->xmax > a->xmax ? b->xmax : a->xmax);
+    a->ymax = (b->ymax > a->ymax ? b->ymax : a->ymax);
+}
+
+#endif
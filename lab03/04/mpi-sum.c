@@ -81,13 +81,34 @@ to hardware limitations and the computation is trivial. Hence, the
 execution time is likely to be dominated by the communication
 operations anyway.
 
+## Map-reduce without a master array
+
+The steps above have two further limitations: the master must hold
+the whole array, and the local sums are collected with $P-1$
+point-to-point messages. The program provided here uses instead the
+function `mr_mapreduce()` from [mpi-mapreduce.h](mpi-mapreduce.h):
+
+- each process _generates_ the elements of its own block of indices
+  (the blocks are balanced for any $N$), so that the array is never
+  stored as a whole;
+
+- inside each process, the block is split among OpenMP threads and
+  reduced in small chunks with a SIMD pairwise summation; the chunk
+  sums are accumulated with Kahan's compensated summation;
+
+- the partial results of the processes are combined with
+  `MPI_Reduce()` using a user-defined operator.
+
+The same function is used to compute the minimum and maximum of the
+array, this time with `MPI_Allreduce()`.
+
 To compile:
 
-        mpicc -std=c99 -Wall -Wpedantic mpi-sum.c -o mpi-sum
+        mpicc -std=c99 -Wall -Wpedantic -fopenmp mpi-sum.c -o mpi-sum
 
 To execute:
 
-        mpirun -n P ./mpi-sun N
+        mpirun -n P ./mpi-sum N
 
 Example:
 
@@ -96,96 +117,88 @@ Example:
 ## Files
 
 - [mpi-sum.c](mpi-sum.c)
+- [mpi-mapreduce.h](mpi-mapreduce.h)
 
 ***/
-#include </usr/lib/aarch64-linux-gnu/openmpi/include/mpi.h>
+#include "mpi-mapreduce.h"
+#include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 
-/* Compute the sum of all elements of array `v` of length `n` */
-float sum(float *v, int n)
-{
-    float sum = 0;
-    int i;
+const float vals[] = {1, -1, 2, -2, 0};
+#define NVALS ((long)(sizeof(vals)/sizeof(vals[0])))
 
-    for (i=0; i<n; i++) {
-        sum += v[i];
+/* Fill `v` with the `n` elements of the input array starting at
+   (global) index `start` */
+void fill_range(float *v, long start, long n)
+{
+    for (long i=0; i<n; i++) {
+        v[i] = vals[(start + i) % NVALS];
     }
-    return sum;
 }
 
-/* Fill the array array `v` of length `n`; return the sum of the
-   content of `v` */
-float fill(float *v, int n)
+/* Return the sum of the first `n` elements of the input array */
+float expected_sum(long n)
 {
-    const float vals[] = {1, -1, 2, -2, 0};
-    const int NVALS = sizeof(vals)/sizeof(vals[0]);
-    int i;
-
-    for (i=0; i<n; i++) {
-        v[i] = vals[i % NVALS];
-    }
-    switch(i % NVALS) {
+    switch(n % NVALS) {
     case 1: return 1; break;
     case 3: return 2; break;
     default: return 0;
     }
 }
 
+/* map() functions for mr_mapreduce(); each one generates the
+   elements lo .. hi-1 (at most MR_BLOCK) in a local buffer */
+void sum_map(long lo, long hi, void *acc, void *arg)
+{
+    float buf[MR_BLOCK];
+    fill_range(buf, lo, hi - lo);
+    mr_ksum_add((mr_ksum_t*)acc, mr_sum_pairwise(buf, hi - lo));
+}
+
+void minmax_map(long lo, long hi, void *acc, void *arg)
+{
+    float buf[MR_BLOCK];
+    fill_range(buf, lo, hi - lo);
+    mr_minmax_add((mr_minmax_t*)acc, buf, hi - lo);
+}
+
 int main( int argc, char *argv[] )
 {
-    int my_rank, comm_sz;
-    float *master_array = NULL, s = 0, expected;
-    int n = 10000;
+    int my_rank;
+    long n = 10000;
+    const mr_reducer_t sum_reducer = {sizeof(mr_ksum_t), mr_ksum_init, sum_map, mr_ksum_combine};
+    const mr_reducer_t minmax_reducer = {sizeof(mr_minmax_t), mr_minmax_init, minmax_map, mr_minmax_combine};
+    mr_ksum_t s;
+    mr_minmax_t mm;
 
     MPI_Init( &argc, &argv );
     MPI_Comm_rank( MPI_COMM_WORLD, &my_rank );
-    MPI_Comm_size( MPI_COMM_WORLD, &comm_sz );
 
     if ( argc > 1 ) {
-        n = atoi(argv[1]);
-    }
-
-    /* The master initializes the array */
-    if ( 0 == my_rank ) {
-        master_array = (float*)malloc( n * sizeof(float) );
-        assert(master_array != NULL);
-        expected = fill(master_array, n);
-    }
-
-    float *recv_array = (float*)malloc((n / comm_sz) * sizeof(float));
-    float local_sum = 0.0;
-
-    MPI_Scatter(master_array, n / comm_sz, MPI_FLOAT, recv_array, n / comm_sz, MPI_FLOAT, 0, MPI_COMM_WORLD);
-
-    assert(recv_array != NULL);
-
-    local_sum = sum(recv_array, n / comm_sz);
-
-    if (0 != my_rank) {
-      MPI_Send(&local_sum, 1, MPI_FLOAT, 0, 0, MPI_COMM_WORLD);
-    } else {
-      s = local_sum;
-      for (int i = 1; i < comm_sz; ++i) {
-        float tmp = 0.0;
-        MPI_Recv(&tmp, 1, MPI_FLOAT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        s += tmp;
-      }
+        n = atol(argv[1]);
     }
 
-    free(master_array);
-    free(recv_array);
+    const double tstart = MPI_Wtime();
+    mr_mapreduce(&sum_reducer, n, NULL, &s, 0, MPI_COMM_WORLD);
+    const double elapsed = MPI_Wtime() - tstart;
+    mr_mapreduce(&minmax_reducer, n, NULL, &mm, -1, MPI_COMM_WORLD);
 
     if (0 == my_rank) {
-        printf("Sum=%f, expected=%f\n", s, expected);
-        if (s == expected) {
+        const float expected = expected_sum(n);
+        const float sum = s.sum - s.c;
+        printf("Sum=%f, expected=%f\n", sum, expected);
+        if (sum == expected) {
             printf("Test OK\n");
         } else {
             printf("Test FAILED\n");
         }
+        printf("Min=%f, Max=%f\n", mm.min, mm.max);
+        printf("Elapsed time (s) : %f\n", elapsed);
     }
 
     MPI_Finalize();
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,229 @@
+/****************************************************************************
+ *
+ * mpi-coll-bench.c - Benchmark of the collectives in mpi-coll.h
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ****************************************************************************/
+
+/***
+% HPC - Benchmark of hand-made broadcast and reduction algorithms
+
+This program compares the broadcast and reduction algorithms of
+[mpi-coll.h](mpi-coll.h) against `MPI_Bcast()` and `MPI_Reduce()` of
+the MPI implementation, for message sizes from 4 bytes to `MAXBYTES`
+(default 16 MB), doubling by a factor of 4 at each step. The root is
+process 0.
+
+For each size, the program checks that every algorithm produces the
+correct result, then prints one line per algorithm in CSV format:
+
+        op,algorithm,bytes,time
+
+where `time` is the average wall clock time (in seconds) of one
+operation, taken as the maximum among all processes. After the table,
+the program prints for each size the fastest algorithm and the
+speedup with respect to the vendor implementation; the sizes where the
+winner changes are the crossover points to use when selecting an
+algorithm.
+
+The segment size of the pipelined algorithms can be set with the
+second command-line parameter (default 32 KB).
+
+To compile:
+
+        mpicc -std=c99 -Wall -Wpedantic mpi-coll-bench.c -o mpi-coll-bench
+
+To execute:
+
+        mpirun -n P ./mpi-coll-bench [MAXBYTES [SEGBYTES]]
+
+Example:
+
+        mpirun -n 8 ./mpi-coll-bench 16777216 32768 > coll.csv
+
+## Files
+
+- [mpi-coll-bench.c](mpi-coll-bench.c)
+- [mpi-coll.h](mpi-coll.h)
+
+***/
+
+#include "mpi-coll.h"
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* Number of repetitions of each operation; large messages use fewer
+   repetitions to keep the total time reasonable */
+int nrep( int nbytes )
+{
+    return (nbytes <= 65536 ? 100 : (nbytes <= 1048576 ? 20 : 5));
+}
+
+enum { BCAST_VENDOR, BCAST_BINOMIAL, BCAST_4NOMIAL, BCAST_PIPELINE, BCAST_2LEVEL, NBCAST };
+const char *bcast_name[] = {"MPI_Bcast", "binomial", "4-nomial", "pipeline", "2level"};
+
+enum { REDUCE_VENDOR, REDUCE_BINOMIAL, REDUCE_4NOMIAL, REDUCE_PIPELINE, REDUCE_2LEVEL, NREDUCE };
+const char *reduce_name[] = {"MPI_Reduce", "binomial", "4-nomial", "pipeline", "2level"};
+
+void do_bcast( int alg, int *buf, int count, coll_topo_t *topo, int seg_count )
+{
+    switch (alg) {
+    case BCAST_VENDOR: MPI_Bcast(buf, count, MPI_INT, 0, MPI_COMM_WORLD); break;
+    case BCAST_BINOMIAL: coll_bcast_knomial(buf, count, MPI_INT, 0, MPI_COMM_WORLD, 2); break;
+    case BCAST_4NOMIAL: coll_bcast_knomial(buf, count, MPI_INT, 0, MPI_COMM_WORLD, 4); break;
+    case BCAST_PIPELINE: coll_bcast_pipeline(buf, count, MPI_INT, 0, MPI_COMM_WORLD, seg_count); break;
+    case BCAST_2LEVEL: coll_bcast_2level(buf, count, MPI_INT, 0, topo, seg_count); break;
+    default: assert(0);
+    }
+}
+
+void do_reduce( int alg, const int *sendbuf, int *recvbuf, int count, coll_topo_t *topo, int seg_count )
+{
+    switch (alg) {
+    case REDUCE_VENDOR: MPI_Reduce(sendbuf, recvbuf, count, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD); break;
+    case REDUCE_BINOMIAL: coll_reduce_knomial(sendbuf, recvbuf, count, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD, 2); break;
+    case REDUCE_4NOMIAL: coll_reduce_knomial(sendbuf, recvbuf, count, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD, 4); break;
+    case REDUCE_PIPELINE: coll_reduce_pipeline(sendbuf, recvbuf, count, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD, seg_count); break;
+    case REDUCE_2LEVEL: coll_reduce_2level(sendbuf, recvbuf, count, MPI_INT, MPI_SUM, 0, topo, seg_count); break;
+    default: assert(0);
+    }
+}
+
+/* Return the maximum of `t` among all processes */
+double max_time( double t )
+{
+    double tmax;
+    MPI_Allreduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return tmax;
+}
+
+int main( int argc, char *argv[] )
+{
+    int my_rank, comm_sz;
+    int maxbytes = 16*1024*1024, segbytes = 32*1024;
+    int nsizes = 0, ok = 1;
+    coll_topo_t topo;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+    if (argc > 1) {
+        maxbytes = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        segbytes = atoi(argv[2]);
+    }
+    const int maxcount = (maxbytes + sizeof(int) - 1) / sizeof(int);
+    const int seg_count = (segbytes >= (int)sizeof(int) ? segbytes / sizeof(int) : 1);
+
+    int *buf = (int*)malloc(maxcount * sizeof(int));
+    int *res = (int*)malloc(maxcount * sizeof(int));
+    assert(buf != NULL && res != NULL);
+
+    coll_topo_init(&topo, MPI_COMM_WORLD, 1024*1024);
+
+    for (int count = 1; count <= maxcount; count *= 4) {
+        nsizes++;
+    }
+    double *t_bcast = (double*)malloc(nsizes * NBCAST * sizeof(double));
+    double *t_reduce = (double*)malloc(nsizes * NREDUCE * sizeof(double));
+    assert(t_bcast != NULL && t_reduce != NULL);
+
+    if (0 == my_rank) {
+        printf("op,algorithm,bytes,time\n");
+    }
+
+    int sz = 0;
+    for (int count = 1; count <= maxcount; count *= 4, sz++) {
+        const int nbytes = count * sizeof(int);
+        const int NREP = nrep(nbytes);
+
+        for (int alg = 0; alg < NBCAST; alg++) {
+            /* check */
+            for (int i=0; i<count; i++) {
+                buf[i] = (0 == my_rank ? i : -1);
+            }
+            do_bcast(alg, buf, count, &topo, seg_count);
+            for (int i=0; i<count; i++) {
+                ok = ok && (buf[i] == i);
+            }
+            /* time */
+            MPI_Barrier(MPI_COMM_WORLD);
+            const double tstart = MPI_Wtime();
+            for (int r=0; r<NREP; r++) {
+                do_bcast(alg, buf, count, &topo, seg_count);
+            }
+            t_bcast[sz*NBCAST + alg] = max_time((MPI_Wtime() - tstart) / NREP);
+            if (0 == my_rank) {
+                printf("bcast,%s,%d,%e\n", bcast_name[alg], nbytes, t_bcast[sz*NBCAST + alg]);
+            }
+        }
+
+        for (int alg = 0; alg < NREDUCE; alg++) {
+            for (int i=0; i<count; i++) {
+                buf[i] = my_rank + i;
+                res[i] = -1;
+            }
+            do_reduce(alg, buf, res, count, &topo, seg_count);
+            if (0 == my_rank) {
+                for (int i=0; i<count; i++) {
+                    ok = ok && (res[i] == comm_sz*(comm_sz-1)/2 + comm_sz*i);
+                }
+            }
+            MPI_Barrier(MPI_COMM_WORLD);
+            const double tstart = MPI_Wtime();
+            for (int r=0; r<NREP; r++) {
+                do_reduce(alg, buf, res, count, &topo, seg_count);
+            }
+            t_reduce[sz*NREDUCE + alg] = max_time((MPI_Wtime() - tstart) / NREP);
+            if (0 == my_rank) {
+                printf("reduce,%s,%d,%e\n", reduce_name[alg], nbytes, t_reduce[sz*NREDUCE + alg]);
+            }
+        }
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+
+    if (0 == my_rank) {
+        fprintf(stderr, "\nP=%d, segment size=%d bytes, results %s\n",
+                comm_sz, seg_count * (int)sizeof(int), ok ? "OK" : "WRONG");
+        fprintf(stderr, "%10s  %-10s %8s  %-10s %8s\n", "bytes", "bcast", "speedup", "reduce", "speedup");
+        sz = 0;
+        for (int count = 1; count <= maxcount; count *= 4, sz++) {
+            int bb = 0, br = 0;
+            for (int alg = 1; alg < NBCAST; alg++) {
+                if (t_bcast[sz*NBCAST + alg] < t_bcast[sz*NBCAST + bb]) bb = alg;
+            }
+            for (int alg = 1; alg < NREDUCE; alg++) {
+                if (t_reduce[sz*NREDUCE + alg] < t_reduce[sz*NREDUCE + br]) br = alg;
+            }
+            fprintf(stderr, "%10d  %-10s %8.2f  %-10s %8.2f\n",
+                    count * (int)sizeof(int),
+                    bcast_name[bb], t_bcast[sz*NBCAST] / t_bcast[sz*NBCAST + bb],
+                    reduce_name[br], t_reduce[sz*NREDUCE] / t_reduce[sz*NREDUCE + br]);
+        }
+    }
+
+    coll_topo_free(&topo);
+    free(t_bcast);
+    free(t_reduce);
+    free(buf);
+    free(res);
+    MPI_Finalize();
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,442 @@
+/****************************************************************************
+ *
+ * mpi-coll.h - Broadcast and reduction algorithms built on top of
+ * point-to-point communications
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * --------------------------------------------------------------------------
+ *
+ * This header file generalizes my_Bcast() of lab03/02 (a binary tree
+ * that sends a single int with blocking MPI_Send) to a small set of
+ * collective algorithms on arbitrary buffers:
+ *
+ * - coll_bcast_knomial(), coll_reduce_knomial(): k-nomial trees; k=2
+ *   is the binomial tree used by most MPI implementations for short
+ *   messages. A larger k gives a shallower tree, at the cost of more
+ *   sends per internal node.
+ *
+ * - coll_bcast_pipeline(), coll_reduce_pipeline(): the buffer is cut
+ *   into segments that flow along a chain of processes; process p
+ *   forwards segment s while it receives segment s+1. For large
+ *   buffers the time approaches that of a single transfer of the
+ *   whole buffer, independently from the number of processes.
+ *
+ * - coll_bcast_2level(), coll_reduce_2level(): node-aware schemes.
+ *   The processes of each node (found with MPI_Comm_split_type) elect
+ *   a leader; only leaders communicate across nodes, while data is
+ *   distributed inside a node through a shared-memory window.
+ *
+ * All functions have the same semantics of MPI_Bcast() and
+ * MPI_Reduce(), with the following restrictions: `datatype` must be
+ * contiguous, MPI_IN_PLACE is not supported, and the reduction
+ * operator `op` must be commutative (the order in which the partial
+ * results are combined is not the order of the ranks).
+ *
+ ****************************************************************************/
+
+#ifndef MPI_COLL_H
+#define MPI_COLL_H
+
+#include <mpi.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Tag used by all point-to-point communications below */
+#define COLL_TAG 4321
+
+/* Return the address of element `i` of buffer `buf` of type `datatype` */
+char *coll_ptr( const void *buf, MPI_Aint i, MPI_Datatype datatype )
+{
+    MPI_Aint lb, extent;
+    MPI_Type_get_extent(datatype, &lb, &extent);
+    return (char*)buf + i * extent;
+}
+
+/******************************************************************************
+ * k-nomial trees
+ ******************************************************************************/
+
+/**
+ * Broadcast `count` elements of `buf` from `root` using a k-nomial
+ * tree, k >= 2.
+ *
+ * Ranks are renumbered so that the root is 0 (virtual rank `vr`).
+ * Process vr receives from the process obtained by clearing its
+ * lowest nonzero base-k digit, then sends to vr + j*mask (j=1..k-1)
+ * for all powers of k `mask` below its lowest nonzero digit. With k=2
+ * and P=8: 0 sends to 4, 2, 1; 4 sends to 6, 5; 2 sends to 3; 6 sends
+ * to 7.
+ */
+void coll_bcast_knomial( void *buf, int count, MPI_Datatype datatype,
+                         int root, MPI_Comm comm, int k )
+{
+    int my_rank, comm_sz, mask, nlevels = 0, nreq = 0;
+    MPI_Request *reqs;
+
+    assert(k >= 2);
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &comm_sz);
+    const int vr = (my_rank - root + comm_sz) % comm_sz;
+    for (mask = 1; mask < comm_sz; mask *= k) {
+        nlevels++;
+    }
+
+    /* Receive from the parent */
+    mask = 1;
+    while (mask < comm_sz) {
+        if (vr % (k*mask) != 0) {
+            const int parent = vr - vr % (k*mask);
+            MPI_Recv(buf, count, datatype, (parent + root) % comm_sz,
+                     COLL_TAG, comm, MPI_STATUS_IGNORE);
+            break;
+        }
+        mask *= k;
+    }
+
+    /* Send to the children; the sends are nonblocking, so that all
+       children are served concurrently. */
+    reqs = (MPI_Request*)malloc(((k - 1) * nlevels + 1) * sizeof(*reqs));
+    assert(reqs != NULL);
+    for (mask /= k; mask > 0; mask /= k) {
+        for (int j=1; j<k; j++) {
+            const int child = vr + j*mask;
+            if (child < comm_sz) {
+                MPI_Isend(buf, count, datatype, (child + root) % comm_sz,
+                          COLL_TAG, comm, &reqs[nreq++]);
+            }
+        }
+    }
+    MPI_Waitall(nreq, reqs, MPI_STATUSES_IGNORE);
+    free(reqs);
+}
+
+/**
+ * Reduce `count` elements of `sendbuf` from all processes into
+ * `recvbuf` of `root` using a k-nomial tree. This is the mirror image
+ * of coll_bcast_knomial(): each process first receives and combines
+ * the partial results of its children, then sends its own partial
+ * result to the parent.
+ */
+void coll_reduce_knomial( const void *sendbuf, void *recvbuf, int count,
+                          MPI_Datatype datatype, MPI_Op op, int root,
+                          MPI_Comm comm, int k )
+{
+    int my_rank, comm_sz, mask, type_size;
+    char *acc, *tmp;
+
+    assert(k >= 2);
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &comm_sz);
+    MPI_Type_size(datatype, &type_size);
+    const int vr = (my_rank - root + comm_sz) % comm_sz;
+    const size_t nbytes = (size_t)count * type_size;
+
+    acc = (vr == 0 ? (char*)recvbuf : (char*)malloc(nbytes));
+    tmp = (char*)malloc(nbytes);
+    assert(acc != NULL && tmp != NULL);
+    if (acc != sendbuf) {
+        memcpy(acc, sendbuf, nbytes);
+    }
+
+    for (mask = 1; mask < comm_sz; mask *= k) {
+        if (vr % (k*mask) != 0) {
+            /* All children have been combined; send to the parent */
+            const int parent = vr - vr % (k*mask);
+            MPI_Send(acc, count, datatype, (parent + root) % comm_sz,
+                     COLL_TAG, comm);
+            break;
+        }
+        for (int j=1; j<k; j++) {
+            const int child = vr + j*mask;
+            if (child < comm_sz) {
+                MPI_Recv(tmp, count, datatype, (child + root) % comm_sz,
+                         COLL_TAG, comm, MPI_STATUS_IGNORE);
+                MPI_Reduce_local(tmp, acc, count, datatype, op);
+            }
+        }
+    }
+
+    if (vr != 0) {
+        free(acc);
+    }
+    free(tmp);
+}
+
+/******************************************************************************
+ * Segmented pipelines
+ ******************************************************************************/
+
+/**
+ * Broadcast `count` elements of `buf` from `root` along the chain
+ * root -> root+1 -> ... -> root-1, cutting the buffer into segments
+ * of (at most) `seg_count` elements.
+ */
+void coll_bcast_pipeline( void *buf, int count, MPI_Datatype datatype,
+                          int root, MPI_Comm comm, int seg_count )
+{
+    int my_rank, comm_sz, nreq = 0;
+    MPI_Request *reqs;
+
+    assert(seg_count > 0);
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &comm_sz);
+    const int vr = (my_rank - root + comm_sz) % comm_sz;
+    const int prev = (vr > 0 ? (my_rank - 1 + comm_sz) % comm_sz : MPI_PROC_NULL);
+    const int next = (vr < comm_sz - 1 ? (my_rank + 1) % comm_sz : MPI_PROC_NULL);
+    const int nseg = (count + seg_count - 1) / seg_count;
+
+    reqs = (MPI_Request*)malloc((nseg > 0 ? nseg : 1) * sizeof(*reqs));
+    assert(reqs != NULL);
+    for (int s=0; s<nseg; s++) {
+        const int start = s * seg_count;
+        const int len = (count - start < seg_count ? count - start : seg_count);
+        char *seg = coll_ptr(buf, start, datatype);
+        /* A receive from/send to MPI_PROC_NULL completes immediately */
+        MPI_Recv(seg, len, datatype, prev, COLL_TAG, comm, MPI_STATUS_IGNORE);
+        MPI_Isend(seg, len, datatype, next, COLL_TAG, comm, &reqs[nreq++]);
+    }
+    MPI_Waitall(nreq, reqs, MPI_STATUSES_IGNORE);
+    free(reqs);
+}
+
+/**
+ * Reduce `count` elements of `sendbuf` into `recvbuf` of `root`
+ * along the chain root-1 -> root-2 -> ... -> root, segment by
+ * segment: each process receives segment s from its successor,
+ * combines it with its own data and forwards it to its predecessor.
+ */
+void coll_reduce_pipeline( const void *sendbuf, void *recvbuf, int count,
+                           MPI_Datatype datatype, MPI_Op op, int root,
+                           MPI_Comm comm, int seg_count )
+{
+    int my_rank, comm_sz, type_size, nreq = 0;
+    MPI_Request *reqs;
+    char *acc, *tmp;
+
+    assert(seg_count > 0);
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &comm_sz);
+    MPI_Type_size(datatype, &type_size);
+    const int vr = (my_rank - root + comm_sz) % comm_sz;
+    const int prev = (vr > 0 ? (my_rank - 1 + comm_sz) % comm_sz : MPI_PROC_NULL);
+    const int next = (vr < comm_sz - 1 ? (my_rank + 1) % comm_sz : MPI_PROC_NULL);
+    const int nseg = (count + seg_count - 1) / seg_count;
+    const size_t nbytes = (size_t)count * type_size;
+
+    acc = (vr == 0 ? (char*)recvbuf : (char*)malloc(nbytes));
+    tmp = (char*)malloc((size_t)seg_count * type_size);
+    reqs = (MPI_Request*)malloc((nseg > 0 ? nseg : 1) * sizeof(*reqs));
+    assert(acc != NULL && tmp != NULL && reqs != NULL);
+    if (acc != sendbuf) {
+        memcpy(acc, sendbuf, nbytes);
+    }
+
+    for (int s=0; s<nseg; s++) {
+        const int start = s * seg_count;
+        const int len = (count - start < seg_count ? count - start : seg_count);
+        char *seg = coll_ptr(acc, start, datatype);
+        if (next != MPI_PROC_NULL) {
+            MPI_Recv(tmp, len, datatype, next, COLL_TAG, comm, MPI_STATUS_IGNORE);
+            MPI_Reduce_local(tmp, seg, len, datatype, op);
+        }
+        /* Segment s of `acc` is not modified anymore */
+        MPI_Isend(seg, len, datatype, prev, COLL_TAG, comm, &reqs[nreq++]);
+    }
+    MPI_Waitall(nreq, reqs, MPI_STATUSES_IGNORE);
+
+    if (vr != 0) {
+        free(acc);
+    }
+    free(tmp);
+    free(reqs);
+}
+
+/******************************************************************************
+ * Node-aware two-level schemes
+ ******************************************************************************/
+
+/* Description of the node topology of a communicator; must be
+   initialized with coll_topo_init() (a collective operation) and
+   released with coll_topo_free(). */
+typedef struct {
+    MPI_Comm comm;        /* the whole communicator */
+    MPI_Comm node_comm;   /* processes on the same node as this one */
+    MPI_Comm leader_comm; /* leaders of all nodes (MPI_COMM_NULL if not a leader) */
+    int node_rank;        /* rank in node_comm; the leader has rank 0 */
+    int *node_of;         /* node_of[r] = rank in leader_comm of the leader of r */
+    int *leader_of;       /* leader_of[r] = rank in comm of the leader of r */
+    MPI_Win win;          /* shared-memory window, one per node */
+    char *shm;            /* base address of the shared segment */
+    MPI_Aint shm_bytes;   /* size of the shared segment */
+} coll_topo_t;
+
+/**
+ * Initialize `t` for communicator `comm`; each node allocates a
+ * shared segment of `shm_bytes` bytes, which is used to broadcast
+ * data inside the node (larger buffers are sent in chunks).
+ */
+void coll_topo_init( coll_topo_t *t, MPI_Comm comm, MPI_Aint shm_bytes )
+{
+    int my_rank, comm_sz, node_id = -1, disp_unit;
+    MPI_Aint sz;
+
+    assert(shm_bytes > 0);
+    t->comm = comm;
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &comm_sz);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &t->node_comm);
+    MPI_Comm_rank(t->node_comm, &t->node_rank);
+    MPI_Comm_split(comm, (t->node_rank == 0 ? 0 : MPI_UNDEFINED), my_rank, &t->leader_comm);
+
+    /* Each leader tells the processes of its node its rank in
+       leader_comm; then everybody learns where everybody else is */
+    if (t->leader_comm != MPI_COMM_NULL) {
+        MPI_Comm_rank(t->leader_comm, &node_id);
+    }
+    MPI_Bcast(&node_id, 1, MPI_INT, 0, t->node_comm);
+    int leader = my_rank;
+    MPI_Bcast(&leader, 1, MPI_INT, 0, t->node_comm);
+    t->node_of = (int*)malloc(comm_sz * sizeof(int));
+    t->leader_of = (int*)malloc(comm_sz * sizeof(int));
+    assert(t->node_of != NULL && t->leader_of != NULL);
+    MPI_Allgather(&node_id, 1, MPI_INT, t->node_of, 1, MPI_INT, comm);
+    MPI_Allgather(&leader, 1, MPI_INT, t->leader_of, 1, MPI_INT, comm);
+
+    /* Only the leader contributes memory to the window; the other
+       processes query the address of the leader's segment */
+    t->shm_bytes = shm_bytes;
+    MPI_Win_allocate_shared((t->node_rank == 0 ? shm_bytes : 0), 1, MPI_INFO_NULL,
+                            t->node_comm, &t->shm, &t->win);
+    MPI_Win_shared_query(t->win, 0, &sz, &disp_unit, &t->shm);
+}
+
+void coll_topo_free( coll_topo_t *t )
+{
+    MPI_Win_free(&t->win);
+    if (t->leader_comm != MPI_COMM_NULL) {
+        MPI_Comm_free(&t->leader_comm);
+    }
+    MPI_Comm_free(&t->node_comm);
+    free(t->node_of);
+    free(t->leader_of);
+}
+
+/**
+ * Broadcast `count` elements of `buf` from `root` (a rank in
+ * t->comm) in three steps:
+ *
+ * 1. if `root` is not the leader of its node, it sends the buffer to
+ *    its leader;
+ *
+ * 2. the leaders broadcast the buffer with a binomial tree (short
+ *    messages) or a segmented pipeline (long messages);
+ *
+ * 3. each leader copies the buffer, one chunk at a time, into the
+ *    shared segment of its node, from where the other processes of
+ *    the node copy it out.
+ */
+void coll_bcast_2level( void *buf, int count, MPI_Datatype datatype,
+                        int root, coll_topo_t *t, int seg_count )
+{
+    int my_rank, type_size;
+    const int root_leader = t->leader_of[root];
+
+    MPI_Comm_rank(t->comm, &my_rank);
+    MPI_Type_size(datatype, &type_size);
+    const size_t nbytes = (size_t)count * type_size;
+
+    if (root != root_leader) {
+        if (my_rank == root) {
+            MPI_Send(buf, count, datatype, root_leader, COLL_TAG, t->comm);
+        } else if (my_rank == root_leader) {
+            MPI_Recv(buf, count, datatype, root, COLL_TAG, t->comm, MPI_STATUS_IGNORE);
+        }
+    }
+
+    if (t->leader_comm != MPI_COMM_NULL) {
+        if (count > seg_count) {
+            coll_bcast_pipeline(buf, count, datatype, t->node_of[root], t->leader_comm, seg_count);
+        } else {
+            coll_bcast_knomial(buf, count, datatype, t->node_of[root], t->leader_comm, 2);
+        }
+    }
+
+    /* The barriers order the writes of the leader before the reads of
+       the other processes, and the reads of one chunk before the
+       writes of the next one */
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, t->win);
+    for (size_t off = 0; off < nbytes; off += t->shm_bytes) {
+        const size_t len = (nbytes - off < (size_t)t->shm_bytes ? nbytes - off : (size_t)t->shm_bytes);
+        if (t->node_rank == 0) {
+            memcpy(t->shm, (char*)buf + off, len);
+        }
+        MPI_Win_sync(t->win);
+        MPI_Barrier(t->node_comm);
+        MPI_Win_sync(t->win);
+        if (t->node_rank != 0 && my_rank != root) {
+            memcpy((char*)buf + off, t->shm, len);
+        }
+        MPI_Barrier(t->node_comm);
+    }
+    MPI_Win_unlock_all(t->win);
+}
+
+/**
+ * Reduce `count` elements of `sendbuf` into `recvbuf` of `root`:
+ * first inside each node (binomial tree over node_comm, whose
+ * point-to-point messages go through shared memory), then among the
+ * leaders, rooted at the leader of `root`; finally the leader of
+ * `root` sends the result to `root`, if they differ.
+ */
+void coll_reduce_2level( const void *sendbuf, void *recvbuf, int count,
+                         MPI_Datatype datatype, MPI_Op op, int root,
+                         coll_topo_t *t, int seg_count )
+{
+    int my_rank, type_size;
+    const int root_leader = t->leader_of[root];
+    char *node_acc = NULL;
+
+    MPI_Comm_rank(t->comm, &my_rank);
+    MPI_Type_size(datatype, &type_size);
+    if (t->node_rank == 0) {
+        node_acc = (char*)malloc((size_t)count * type_size);
+        assert(node_acc != NULL);
+    }
+
+    coll_reduce_knomial(sendbuf, node_acc, count, datatype, op, 0, t->node_comm, 2);
+
+    if (t->leader_comm != MPI_COMM_NULL) {
+        char *result = (my_rank == root ? (char*)recvbuf : node_acc);
+        if (count > seg_count) {
+            coll_reduce_pipeline(node_acc, result, count, datatype, op,
+                                 t->node_of[root], t->leader_comm, seg_count);
+        } else {
+            coll_reduce_knomial(node_acc, result, count, datatype, op,
+                                t->node_of[root], t->leader_comm, 2);
+        }
+        /* the result is now in node_acc of root_leader */
+    }
+
+    if (root != root_leader) {
+        if (my_rank == root_leader) {
+            MPI_Send(node_acc, count, datatype, root, COLL_TAG, t->comm);
+        } else if (my_rank == root) {
+            MPI_Recv(recvbuf, count, datatype, root_leader, COLL_TAG, t->comm, MPI_STATUS_IGNORE);
+        }
+    }
+    free(node_acc);
+}
+
+#endif
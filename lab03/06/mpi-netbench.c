@@ -0,0 +1,440 @@
+/****************************************************************************
+ *
+ * mpi-netbench.c - Point-to-point and collective communication
+ * microbenchmarks, with latency/bandwidth model fitting
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ****************************************************************************/
+
+/***
+% HPC - Communication microbenchmarks and cost models
+
+The simplest model of the time required to send a message of $m$
+bytes between two processes is
+
+$$
+T(m) = \alpha + \beta m
+$$
+
+where $\alpha$ is the _latency_ (seconds) and $1/\beta$ the
+_bandwidth_ (bytes/second). This program measures the following
+communication patterns, for message sizes from 1 byte to `MAXBYTES`
+(default 4 MB), quadrupling at each step:
+
+- `pingpong`: process 0 sends $m$ bytes to a partner that sends them
+  back; the time is half the round trip. The partner is chosen both on
+  the same node of process 0 (`intra`) and on a different node
+  (`inter`), when they exist. Nodes are found with
+  `MPI_Comm_split_type(MPI_COMM_TYPE_SHARED)`.
+
+- `ring`: like [mpi-ring.c](../01/mpi-ring.c), a message of $m$
+  bytes goes once around all $P$ processes; the time is divided by
+  $P$.
+
+- `halo1d`: every process exchanges $m$ bytes with its left and
+  right neighbors on a periodic 1-D decomposition (e.g., the cellular
+  automata of lab05).
+
+- `halo2d`: every process exchanges $m$ bytes with its four
+  neighbors on a periodic 2-D Cartesian topology built with
+  `MPI_Dims_create()`/`MPI_Cart_create()`.
+
+- `allgatherv`, `alltoallv`: each process sends $m$ bytes to each
+  process (for `allgatherv`, the same $m$ bytes to all of them), so
+  that every size, including the smallest ones, moves $m$ bytes
+  between each pair of processes.
+
+Each measured time is the maximum among all processes of the average
+of several repetitions. The program then fits $T(m) = a + b m$ for
+each pattern: $b$ is the least-squares slope over the larger half of
+the sizes, and $a$ is taken from the smaller half (see
+`fit_linear()`). The raw measures are printed in CSV format on
+standard output:
+
+        bench,placement,bytes,time
+
+followed by the fitted parameters on standard error. The fitted
+parameters are also written to a _machine profile_, a plain text file
+of `key=value` lines that other programs can parse to tune their
+decomposition (e.g., the number of particles per process below which
+communication dominates):
+
+        procs=8
+        nodes=2
+        pingpong_intra_alpha=4.1e-07
+        pingpong_intra_beta=9.2e-11
+        ...
+        allgatherv_a=...
+        allgatherv_b=...
+
+Keys that can not be measured (e.g., `pingpong_inter_*` on a single
+node) are omitted. For the collectives, the ratios `a/alpha` and
+`b/beta` (with respect to the best point-to-point placement) are also
+stored as `*_alpha_ratio` and `*_beta_ratio`; for example, a ring-based
+`MPI_Allgatherv` would have `b/beta` close to $(P-1)$.
+
+To compile:
+
+        mpicc -std=c99 -Wall -Wpedantic mpi-netbench.c -o mpi-netbench
+
+To execute:
+
+        mpirun -n P ./mpi-netbench [MAXBYTES [profile_file]]
+
+Example:
+
+        mpirun -n 8 ./mpi-netbench 4194304 machine-profile.txt > net.csv
+
+## Files
+
+- [mpi-netbench.c](mpi-netbench.c)
+
+***/
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* Number of repetitions of each measure; large messages use fewer
+   repetitions to keep the total time reasonable */
+int nrep( int nbytes )
+{
+    return (nbytes <= 65536 ? 100 : (nbytes <= 1048576 ? 20 : 5));
+}
+
+/* Return the maximum of `t` among all processes */
+double max_time( double t )
+{
+    double tmax;
+    MPI_Allreduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return tmax;
+}
+
+/**
+ * Fit y = a + b*x to the `n` points (x[i], y[i]), where x[] is
+ * increasing. The sizes span several orders of magnitude, so that
+ * a single least-squares fit is dominated by the residuals of the
+ * largest messages, and the intercept (the latency) is lost in their
+ * noise. Instead, b is the least-squares slope of the larger half of
+ * the points, where b*x dominates, and a is the average of y[i] -
+ * b*x[i] over the smaller half, where the latency dominates.
+ */
+void fit_linear( const double *x, const double *y, int n, double *a, double *b )
+{
+    const int h = n / 2; /* points 0 .. h-1 are the "small" ones */
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i=h; i<n; i++) {
+        sx += x[i];
+        sy += y[i];
+        sxx += x[i]*x[i];
+        sxy += x[i]*y[i];
+    }
+    const int m = n - h;
+    const double den = m*sxx - sx*sx;
+    *b = (m > 1 && den != 0 ? (m*sxy - sx*sy) / den : 0);
+    double sa = 0;
+    for (int i=0; i<h; i++) {
+        sa += y[i] - *b * x[i];
+    }
+    *a = (h > 0 ? sa / h : (n > 0 ? y[0] : 0));
+}
+
+/**
+ * Half round-trip time of a message of `nbytes` bytes between process
+ * 0 and `partner`; all other processes do nothing. Returns the time
+ * on all processes.
+ */
+double bench_pingpong( char *buf, int nbytes, int partner )
+{
+    int my_rank;
+    const int NREP = nrep(nbytes);
+    double t = 0;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double tstart = MPI_Wtime();
+    for (int r=0; r<NREP; r++) {
+        if (0 == my_rank) {
+            MPI_Send(buf, nbytes, MPI_BYTE, partner, 0, MPI_COMM_WORLD);
+            MPI_Recv(buf, nbytes, MPI_BYTE, partner, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        } else if (partner == my_rank) {
+            MPI_Recv(buf, nbytes, MPI_BYTE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Send(buf, nbytes, MPI_BYTE, 0, 0, MPI_COMM_WORLD);
+        }
+    }
+    if (0 == my_rank) {
+        t = (MPI_Wtime() - tstart) / (2.0 * NREP);
+    }
+    MPI_Bcast(&t, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    return t;
+}
+
+/* Time per hop of a message of `nbytes` bytes going around the ring */
+double bench_ring( char *buf, int nbytes )
+{
+    int my_rank, comm_sz;
+    const int NREP = nrep(nbytes);
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+    const int next = (my_rank + 1) % comm_sz;
+    const int prev = (my_rank - 1 + comm_sz) % comm_sz;
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double tstart = MPI_Wtime();
+    for (int r=0; r<NREP; r++) {
+        if (0 == my_rank) {
+            MPI_Send(buf, nbytes, MPI_BYTE, next, 0, MPI_COMM_WORLD);
+            MPI_Recv(buf, nbytes, MPI_BYTE, prev, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        } else {
+            MPI_Recv(buf, nbytes, MPI_BYTE, prev, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Send(buf, nbytes, MPI_BYTE, next, 0, MPI_COMM_WORLD);
+        }
+    }
+    return max_time((MPI_Wtime() - tstart) / NREP / comm_sz);
+}
+
+/**
+ * Exchange `nbytes` bytes with all `nneigh` neighbors in `neigh[]`;
+ * `sendbuf` and `recvbuf` must have room for nneigh*nbytes bytes.
+ */
+double bench_halo( char *sendbuf, char *recvbuf, int nbytes, const int *neigh, int nneigh )
+{
+    const int NREP = nrep(nbytes);
+    MPI_Request reqs[8];
+
+    assert(nneigh <= 4);
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double tstart = MPI_Wtime();
+    for (int r=0; r<NREP; r++) {
+        for (int i=0; i<nneigh; i++) {
+            MPI_Irecv(recvbuf + i*nbytes, nbytes, MPI_BYTE, neigh[i], i, MPI_COMM_WORLD, &reqs[i]);
+        }
+        /* what we send to neighbor i is received as coming from the
+           opposite direction, i.e., neighbor i^1 */
+        for (int i=0; i<nneigh; i++) {
+            MPI_Isend(sendbuf + i*nbytes, nbytes, MPI_BYTE, neigh[i], i ^ 1, MPI_COMM_WORLD, &reqs[nneigh + i]);
+        }
+        MPI_Waitall(2*nneigh, reqs, MPI_STATUSES_IGNORE);
+    }
+    return max_time((MPI_Wtime() - tstart) / NREP);
+}
+
+double bench_allgatherv( char *sendbuf, char *recvbuf, int nbytes, int *counts, int *displs )
+{
+    int comm_sz;
+    const int NREP = nrep(nbytes);
+
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+    for (int i=0; i<comm_sz; i++) {
+        counts[i] = nbytes;
+        displs[i] = i*nbytes;
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double tstart = MPI_Wtime();
+    for (int r=0; r<NREP; r++) {
+        MPI_Allgatherv(sendbuf, nbytes, MPI_BYTE, recvbuf, counts, displs, MPI_BYTE, MPI_COMM_WORLD);
+    }
+    return max_time((MPI_Wtime() - tstart) / NREP);
+}
+
+/**
+ * Send `nbytes` bytes to each process; `sendbuf` and `recvbuf` must
+ * have room for comm_sz*nbytes bytes.
+ */
+double bench_alltoallv( char *sendbuf, char *recvbuf, int nbytes, int *counts, int *displs )
+{
+    int comm_sz;
+    const int NREP = nrep(nbytes);
+
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+    for (int i=0; i<comm_sz; i++) {
+        counts[i] = nbytes;
+        displs[i] = i*nbytes;
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double tstart = MPI_Wtime();
+    for (int r=0; r<NREP; r++) {
+        MPI_Alltoallv(sendbuf, counts, displs, MPI_BYTE, recvbuf, counts, displs, MPI_BYTE, MPI_COMM_WORLD);
+    }
+    return max_time((MPI_Wtime() - tstart) / NREP);
+}
+
+enum { PP_INTRA, PP_INTER, RING, HALO1D, HALO2D, ALLGATHERV, ALLTOALLV, NBENCH };
+const char *bench_name[] = {"pingpong", "pingpong", "ring", "halo1d", "halo2d", "allgatherv", "alltoallv"};
+const char *bench_key[] = {"pingpong_intra", "pingpong_inter", "ring", "halo1d", "halo2d", "allgatherv", "alltoallv"};
+
+int main( int argc, char *argv[] )
+{
+    int my_rank, comm_sz, node_rank, nnodes;
+    int maxbytes = 4*1024*1024;
+    const char *profile = "machine-profile.txt";
+    int nsizes = 0;
+    MPI_Comm node_comm;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+    if (argc > 1) {
+        maxbytes = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        profile = argv[2];
+    }
+
+    /* Rank placement: node_of[r] is the (lowest) rank of the leader
+       of the node where process r runs */
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    int leader = my_rank;
+    MPI_Bcast(&leader, 1, MPI_INT, 0, node_comm);
+    int *node_of = (int*)malloc(comm_sz * sizeof(int));
+    assert(node_of != NULL);
+    MPI_Allgather(&leader, 1, MPI_INT, node_of, 1, MPI_INT, MPI_COMM_WORLD);
+    const int is_leader = (node_rank == 0);
+    MPI_Allreduce(&is_leader, &nnodes, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+    /* ping-pong partners of process 0: the first process on the same
+       node, and the first process on a different node (-1 if none) */
+    int partner[2] = {-1, -1};
+    for (int r=1; r<comm_sz; r++) {
+        const int k = (node_of[r] == node_of[0] ? PP_INTRA : PP_INTER);
+        if (partner[k] < 0) {
+            partner[k] = r;
+        }
+    }
+
+    /* 1-D and 2-D periodic neighbors; the order is (left, right,
+       down, up) so that the opposite of direction i is i^1 */
+    int neigh1d[2], neigh2d[4], dims[2] = {0, 0}, periods[2] = {1, 1};
+    MPI_Comm cart;
+    neigh1d[0] = (my_rank - 1 + comm_sz) % comm_sz;
+    neigh1d[1] = (my_rank + 1) % comm_sz;
+    MPI_Dims_create(comm_sz, 2, dims);
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &cart);
+    MPI_Cart_shift(cart, 0, 1, &neigh2d[0], &neigh2d[1]);
+    MPI_Cart_shift(cart, 1, 1, &neigh2d[2], &neigh2d[3]);
+
+    for (int m = 1; m <= maxbytes; m *= 4) {
+        nsizes++;
+    }
+    /* sendbuf holds the four halo2d messages or the comm_sz
+       alltoallv messages */
+    const size_t sendsz = (size_t)(comm_sz > 4 ? comm_sz : 4) * maxbytes + 1;
+    char *sendbuf = (char*)malloc(sendsz);
+    char *recvbuf = (char*)malloc((size_t)comm_sz * maxbytes + 4 * (size_t)maxbytes + 1);
+    int *counts = (int*)malloc(comm_sz * sizeof(int));
+    int *displs = (int*)malloc(comm_sz * sizeof(int));
+    double *sizes = (double*)malloc(nsizes * sizeof(double));
+    double *times = (double*)malloc(nsizes * NBENCH * sizeof(double));
+    assert(sendbuf != NULL && recvbuf != NULL && counts != NULL && displs != NULL);
+    assert(sizes != NULL && times != NULL);
+    memset(sendbuf, my_rank, sendsz);
+
+    if (0 == my_rank) {
+        printf("bench,placement,bytes,time\n");
+    }
+
+    int s = 0;
+    for (int m = 1; m <= maxbytes; m *= 4, s++) {
+        sizes[s] = m;
+        for (int b=0; b<NBENCH; b++) {
+            double t = -1;
+            switch (b) {
+            case PP_INTRA:
+            case PP_INTER:
+                if (partner[b] >= 0) {
+                    t = bench_pingpong(sendbuf, m, partner[b]);
+                }
+                break;
+            case RING: t = bench_ring(sendbuf, m); break;
+            case HALO1D: t = bench_halo(sendbuf, recvbuf, m, neigh1d, 2); break;
+            case HALO2D: t = bench_halo(sendbuf, recvbuf, m, neigh2d, 4); break;
+            case ALLGATHERV: t = bench_allgatherv(sendbuf, recvbuf, m, counts, displs); break;
+            case ALLTOALLV: t = bench_alltoallv(sendbuf, recvbuf, m, counts, displs); break;
+            default: assert(0);
+            }
+            times[s*NBENCH + b] = t;
+            if (0 == my_rank && t >= 0) {
+                const char *placement = (b == PP_INTRA ? "intra" : (b == PP_INTER ? "inter" : "all"));
+                printf("%s,%s,%d,%e\n", bench_name[b], placement, m, t);
+            }
+        }
+    }
+
+    if (0 == my_rank) {
+        FILE *f = fopen(profile, "w");
+        double a[NBENCH], b[NBENCH], y[64];
+        int valid[NBENCH];
+
+        if (f == NULL) {
+            fprintf(stderr, "FATAL: can not create %s\n", profile);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        assert(nsizes <= 64);
+        for (int k=0; k<NBENCH; k++) {
+            for (s=0; s<nsizes; s++) {
+                y[s] = times[s*NBENCH + k];
+            }
+            valid[k] = (y[0] >= 0);
+            if (valid[k]) {
+                fit_linear(sizes, y, nsizes, &a[k], &b[k]);
+            }
+        }
+        /* Reference point-to-point parameters: the intra-node ones on
+           a single node, the inter-node ones otherwise */
+        const int ref = (valid[PP_INTER] ? PP_INTER : PP_INTRA);
+
+        fprintf(f, "# machine profile produced by mpi-netbench.c\n");
+        fprintf(f, "# model: T(m) = a + b*m (seconds, m in bytes)\n");
+        fprintf(f, "procs=%d\n", comm_sz);
+        fprintf(f, "nodes=%d\n", nnodes);
+        fprintf(stderr, "\nP=%d, nodes=%d\n", comm_sz, nnodes);
+        fprintf(stderr, "%-16s %12s %12s %14s\n", "bench", "a (us)", "b (ns/B)", "1/b (MB/s)");
+        for (int k=0; k<NBENCH; k++) {
+            if (!valid[k]) {
+                continue;
+            }
+            if (k == PP_INTRA || k == PP_INTER) {
+                fprintf(f, "%s_alpha=%e\n", bench_key[k], a[k]);
+                fprintf(f, "%s_beta=%e\n", bench_key[k], b[k]);
+            } else {
+                fprintf(f, "%s_a=%e\n", bench_key[k], a[k]);
+                fprintf(f, "%s_b=%e\n", bench_key[k], b[k]);
+                if (valid[ref] && a[ref] > 0 && b[ref] > 0) {
+                    fprintf(f, "%s_alpha_ratio=%f\n", bench_key[k], a[k] / a[ref]);
+                    fprintf(f, "%s_beta_ratio=%f\n", bench_key[k], b[k] / b[ref]);
+                }
+            }
+            fprintf(stderr, "%-16s %12.3f %12.4f %14.1f\n", bench_key[k],
+                    a[k] * 1e6, b[k] * 1e9, (b[k] > 0 ? 1e-6 / b[k] : 0));
+        }
+        fclose(f);
+        fprintf(stderr, "Machine profile written to %s\n", profile);
+    }
+
+    free(sendbuf);
+    free(recvbuf);
+    free(counts);
+    free(displs);
+    free(sizes);
+    free(times);
+    free(node_of);
+    MPI_Comm_free(&cart);
+    MPI_Comm_free(&node_comm);
+    MPI_Finalize();
+    return EXIT_SUCCESS;
+}
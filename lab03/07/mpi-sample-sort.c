@@ -0,0 +1,430 @@
+/****************************************************************************
+ *
+ * mpi-sample-sort.c - Distributed sample sort with MPI and OpenMP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ****************************************************************************/
+
+/***
+% HPC - Distributed sample sort
+
+Each of the $P$ MPI processes holds $n$ keys; at the end, the keys
+must be sorted across processes: each process holds a sorted block,
+and all keys of process $i$ are less than or equal to those of
+process $i+1$. The blocks do not have exactly $n$ keys each, but
+their sizes should be as close as possible to $n$.
+
+This program implements _sample sort_ with _regular sampling_:
+
+1. Each process sorts its keys using the OpenMP Merge Sort of
+   [omp-merge-sort.c](../../lab02/04/omp-merge-sort.c).
+
+2. Each process selects $P$ keys at regular intervals from its sorted
+   array (the _samples_); all samples are collected by all processes
+   with `MPI_Allgather()` and sorted. Then, $P-1$ _splitters_ are
+   taken at regular intervals from the $P^2$ sorted samples. With
+   this choice, no process receives more than about $2n$ keys,
+   whatever the initial distribution of the keys (unless many keys
+   are equal).
+
+3. Each process splits its sorted array into $P$ segments, using
+   binary search to locate the splitters; segment $j$ is sent to
+   process $j$. The segment lengths are exchanged with
+   `MPI_Alltoall()`, so that each process knows how many keys it
+   receives from every other, and then the keys are exchanged with
+   `MPI_Alltoallv()`.
+
+4. Each process receives $P$ sorted segments, that are merged with a
+   $P$-way merge based on a binary heap.
+
+The program prints the (maximum) time of each phase, the minimum,
+average and maximum size of the final blocks (_load balance_), and
+the _throughput_ in keys/s. Since the number of keys per process is
+fixed, running the program with increasing $P$ measures the _weak
+scaling_ behavior: ideally, the throughput should grow linearly with
+$P$. The result is checked by verifying that each block is sorted,
+that the blocks are in order, and that the number and sum of the keys
+did not change.
+
+To compile:
+
+        mpicc -std=c99 -Wall -Wpedantic -fopenmp mpi-sample-sort.c -o mpi-sample-sort
+
+To execute:
+
+        mpirun -n P ./mpi-sample-sort [n]
+
+where $n$ is the number of keys per process (default $10^6$).
+
+Example:
+
+        OMP_NUM_THREADS=2 mpirun -n 4 ./mpi-sample-sort 4000000
+
+## Files
+
+- [mpi-sample-sort.c](mpi-sample-sort.c)
+
+***/
+
+#include <mpi.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+/*
+ * The following functions, up to mergesort(), are the OpenMP Merge
+ * Sort of lab02/04/omp-merge-sort.c.
+ */
+void swap(int* a, int* b)
+{
+    int tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* Sort v[low..high] using selection sort (used for small vectors only) */
+void selectionsort(int* v, int low, int high)
+{
+    int i, j;
+    for (i=low; i<high; i++) {
+        for (j=i+1; j<=high; j++) {
+            if (v[i] > v[j]) {
+                swap(&v[i], &v[j]);
+            }
+        }
+    }
+}
+
+/* Merge src[low..mid] with src[mid+1..high], put the result in
+   dst[low..high] */
+void merge(int* src, int low, int mid, int high, int* dst)
+{
+    int i=low, j=mid+1, k=low;
+    while (i<=mid && j<=high) {
+        if (src[i] <= src[j]) {
+            dst[k] = src[i++];
+        } else {
+            dst[k] = src[j++];
+        }
+        k++;
+    }
+    while (i<=mid) {
+        dst[k] = src[i++];
+        k++;
+    }
+    while (j<=high) {
+        dst[k] = src[j++];
+        k++;
+    }
+}
+
+/* Sort v[i..j] using tmp[i..j] as a temporary buffer */
+void mergesort_rec(int* v, int i, int j, int* tmp)
+{
+    const int CUTOFF = 64;
+    if ( j - i + 1 < CUTOFF )
+        selectionsort(v, i, j);
+    else {
+        const int m = (i+j)/2;
+#pragma omp task shared(i, m)
+        mergesort_rec(v, i, m, tmp);
+#pragma omp task shared(j, m)
+        mergesort_rec(v, m+1, j, tmp);
+#pragma omp taskwait
+        merge(v, i, m, j, tmp);
+        memcpy(v+i, tmp+i, (j-i+1)*sizeof(v[0]));
+    }
+}
+
+/* Sort v[] of length n using Merge Sort */
+void mergesort(int *v, int n)
+{
+    int* tmp = (int*)malloc((n > 0 ? n : 1)*sizeof(v[0]));
+    assert(tmp != NULL);
+#pragma omp parallel default(none) shared(n, v, tmp)
+    {
+#pragma omp master
+        mergesort_rec(v, 0, n-1, tmp);
+    }
+    free(tmp);
+}
+
+/* Return the number of elements of the sorted array v[0..n-1] that
+   are less than or equal to `key` */
+int upper_bound(const int *v, int n, int key)
+{
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        const int m = lo + (hi - lo)/2;
+        if (v[m] <= key) {
+            lo = m + 1;
+        } else {
+            hi = m;
+        }
+    }
+    return lo;
+}
+
+int compare_int(const void *p1, const void *p2)
+{
+    const int a = *(const int*)p1, b = *(const int*)p2;
+    return (a > b) - (a < b);
+}
+
+/* Restore the heap property of heap[0..n-1] from position i down; the
+   heap contains indices of segments, ordered by their current key */
+void sift_down(int *heap, int n, int i, const int *v, const int *pos)
+{
+    const int s = heap[i];
+    while (2*i + 1 < n) {
+        int c = 2*i + 1;
+        if (c + 1 < n && v[pos[heap[c+1]]] < v[pos[heap[c]]]) {
+            c++;
+        }
+        if (v[pos[heap[c]]] >= v[pos[s]]) {
+            break;
+        }
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = s;
+}
+
+/*
+ * Merge the `k` sorted segments v[displs[j] .. displs[j]+counts[j]-1],
+ * j = 0 .. k-1, into out[]. A binary heap contains the nonempty
+ * segments, ordered by their first key not yet merged; each output
+ * key costs O(log k) comparisons.
+ */
+void kway_merge(const int *v, const int *counts, const int *displs, int k, int *out)
+{
+    int *pos = (int*)malloc(k * sizeof(int));
+    int *end = (int*)malloc(k * sizeof(int));
+    int *heap = (int*)malloc(k * sizeof(int));
+    int n = 0, i, o = 0;
+    assert(pos != NULL && end != NULL && heap != NULL);
+
+    for (i=0; i<k; i++) {
+        pos[i] = displs[i];
+        end[i] = displs[i] + counts[i];
+        if (counts[i] > 0) {
+            heap[n++] = i;
+        }
+    }
+    for (i=n/2 - 1; i>=0; i--) {
+        sift_down(heap, n, i, v, pos);
+    }
+    while (n > 0) {
+        const int s = heap[0];
+        out[o++] = v[pos[s]++];
+        if (pos[s] == end[s]) {
+            heap[0] = heap[--n];
+        }
+        if (n > 0) {
+            sift_down(heap, n, 0, v, pos);
+        }
+    }
+    free(pos);
+    free(end);
+    free(heap);
+}
+
+/* Fill v[0..n-1] with pseudo-random nonnegative keys (xorshift64*
+   generator seeded with `seed`) */
+void fill(int *v, int n, uint64_t seed)
+{
+    uint64_t x = 0x9E3779B97F4A7C15ULL * (seed + 1);
+    int i;
+    for (i=0; i<n; i++) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        v[i] = (int)((x * 0x2545F4914F6CDD1DULL) >> 33);
+    }
+}
+
+/* Return the sum of v[0..n-1] modulo 2^64 */
+uint64_t checksum(const int *v, int n)
+{
+    uint64_t s = 0;
+    int i;
+    for (i=0; i<n; i++) {
+        s += (uint64_t)v[i];
+    }
+    return s;
+}
+
+/* Return the maximum of `t` among all processes */
+double max_time( double t )
+{
+    double tmax;
+    MPI_Allreduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return tmax;
+}
+
+int main( int argc, char *argv[] )
+{
+    int my_rank, comm_sz, i;
+    int n = 1000000;
+    double t[5]; /* start/end of each phase */
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+    if (argc > 2) {
+        if (0 == my_rank) {
+            fprintf(stderr, "Usage: %s [n]\n", argv[0]);
+        }
+        MPI_Finalize();
+        return EXIT_FAILURE;
+    }
+    if (argc > 1) {
+        n = atoi(argv[1]);
+    }
+    if (n < comm_sz) {
+        if (0 == my_rank) {
+            fprintf(stderr, "FATAL: n must be at least the number of processes (%d)\n", comm_sz);
+        }
+        MPI_Finalize();
+        return EXIT_FAILURE;
+    }
+
+    int *v = (int*)malloc(n * sizeof(int));
+    int *samples = (int*)malloc(comm_sz * comm_sz * sizeof(int));
+    int *splitters = (int*)malloc(comm_sz * sizeof(int));
+    int *sendcounts = (int*)malloc(comm_sz * sizeof(int));
+    int *sdispls = (int*)malloc(comm_sz * sizeof(int));
+    int *recvcounts = (int*)malloc(comm_sz * sizeof(int));
+    int *rdispls = (int*)malloc(comm_sz * sizeof(int));
+    assert(v != NULL && samples != NULL && splitters != NULL);
+    assert(sendcounts != NULL && sdispls != NULL && recvcounts != NULL && rdispls != NULL);
+
+    fill(v, n, my_rank);
+    uint64_t sum_before = checksum(v, n);
+    MPI_Allreduce(MPI_IN_PLACE, &sum_before, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t[0] = MPI_Wtime();
+
+    /* 1. Local sort */
+    mergesort(v, n);
+    t[1] = MPI_Wtime();
+
+    /* 2. Regular sampling: P samples per process, P-1 splitters */
+    int my_samples[comm_sz];
+    for (i=0; i<comm_sz; i++) {
+        my_samples[i] = v[(long)i * n / comm_sz];
+    }
+    MPI_Allgather(my_samples, comm_sz, MPI_INT, samples, comm_sz, MPI_INT, MPI_COMM_WORLD);
+    qsort(samples, comm_sz * comm_sz, sizeof(int), compare_int);
+    for (i=1; i<comm_sz; i++) {
+        splitters[i-1] = samples[i*comm_sz + comm_sz/2];
+    }
+    t[2] = MPI_Wtime();
+
+    /* 3. Exchange: segment j (keys <= splitters[j], and greater
+       than splitters[j-1]) goes to process j */
+    int prev = 0;
+    for (i=0; i<comm_sz; i++) {
+        const int next = (i < comm_sz - 1 ? upper_bound(v, n, splitters[i]) : n);
+        sendcounts[i] = next - prev;
+        sdispls[i] = prev;
+        prev = next;
+    }
+    MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, MPI_COMM_WORLD);
+    int m = 0;
+    for (i=0; i<comm_sz; i++) {
+        rdispls[i] = m;
+        m += recvcounts[i];
+    }
+    int *recv = (int*)malloc((m > 0 ? m : 1) * sizeof(int));
+    int *sorted = (int*)malloc((m > 0 ? m : 1) * sizeof(int));
+    assert(recv != NULL && sorted != NULL);
+    MPI_Alltoallv(v, sendcounts, sdispls, MPI_INT, recv, recvcounts, rdispls, MPI_INT, MPI_COMM_WORLD);
+    t[3] = MPI_Wtime();
+
+    /* 4. P-way merge of the received segments */
+    kway_merge(recv, recvcounts, rdispls, comm_sz, sorted);
+    t[4] = MPI_Wtime();
+
+    const double elapsed = max_time(t[4] - t[0]);
+    const double t_sort = max_time(t[1] - t[0]);
+    const double t_split = max_time(t[2] - t[1]);
+    const double t_exchange = max_time(t[3] - t[2]);
+    const double t_merge = max_time(t[4] - t[3]);
+
+    /* Check: each block is sorted, the last key of each process is
+       not greater than the first key of the next nonempty block, and
+       the number and sum of the keys did not change */
+    int ok = 1;
+    for (i=1; i<m; i++) {
+        ok = ok && (sorted[i-1] <= sorted[i]);
+    }
+    int ends[3] = {m, (m > 0 ? sorted[0] : 0), (m > 0 ? sorted[m-1] : 0)};
+    int *all_ends = (int*)malloc(3 * comm_sz * sizeof(int));
+    assert(all_ends != NULL);
+    MPI_Gather(ends, 3, MPI_INT, all_ends, 3, MPI_INT, 0, MPI_COMM_WORLD);
+    uint64_t sum_after = checksum(sorted, m);
+    MPI_Allreduce(MPI_IN_PLACE, &sum_after, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+
+    if (0 == my_rank) {
+        long total = 0;
+        int min_m = all_ends[0], max_m = all_ends[0], have_last = 0, last = 0;
+        for (i=0; i<comm_sz; i++) {
+            const int mi = all_ends[3*i];
+            total += mi;
+            min_m = (mi < min_m ? mi : min_m);
+            max_m = (mi > max_m ? mi : max_m);
+            if (mi > 0) {
+                ok = ok && (!have_last || last <= all_ends[3*i + 1]);
+                last = all_ends[3*i + 2];
+                have_last = 1;
+            }
+        }
+        ok = ok && (total == (long)n * comm_sz) && (sum_after == sum_before);
+
+        const double avg_m = (double)total / comm_sz;
+        printf("Processes: %d, threads per process: %d, keys per process: %d\n",
+               comm_sz, omp_get_max_threads(), n);
+        printf("Local sort (s): %f\n", t_sort);
+        printf("Splitters (s):  %f\n", t_split);
+        printf("Exchange (s):   %f\n", t_exchange);
+        printf("Merge (s):      %f\n", t_merge);
+        printf("Total (s):      %f\n", elapsed);
+        printf("Final block sizes: min %d, avg %.1f, max %d (max/avg %.3f)\n",
+               min_m, avg_m, max_m, max_m / avg_m);
+        printf("Throughput (keys/s): %e total, %e per process\n",
+               total / elapsed, total / elapsed / comm_sz);
+        printf("Check %s\n", (ok ? "OK" : "FAILED"));
+    }
+
+    free(v);
+    free(samples);
+    free(splitters);
+    free(sendcounts);
+    free(sdispls);
+    free(recvcounts);
+    free(rdispls);
+    free(recv);
+    free(sorted);
+    free(all_ends);
+
+    MPI_Finalize();
+    return EXIT_SUCCESS;
+}
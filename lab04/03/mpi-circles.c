@@ -21,7 +21,7 @@
 /***
 % HPC - Monte Carlo estimation of the area of the union of circles
 % Moreno Marzolla <moreno.marzolla@unibo.it>
-% Last updated: 2022-10-31
+% Last updated: 2026-10-18
 
 File [mpi-circles.c](mpi-circles.c) contains a serial implementation
 of a Monte Carlo algorithm to estimate the area of ​​the union of $N$
@@ -72,9 +72,43 @@ do this, each process must receive a copy of the coordinates of all
 input circles. The most efficient way to do so is to let the master
 broadcast the values of `cx[i]`, `cy[i]` and `r[i]`.
 
+## Exact area
+
+The Monte Carlo estimate requires $O(KN)$ work, and its error
+decreases only as $1/\sqrt{K}$. The area of the union can instead be
+computed exactly (up to rounding errors) using Green's theorem: the
+area of a region is
+
+$$
+A = \frac{1}{2} \oint (x\, dy - y\, dx)
+$$
+
+where the integral is along the boundary of the region. The boundary
+of the union of circles is made of the arcs of each circle that are
+not inside any other circle; along an arc of the circle with center
+$(c_x, c_y)$ and radius $r$ from angle $t_1$ to $t_2$, the integral
+is
+
+$$
+\frac{1}{2} \left[ r c_x (\sin t_2 - \sin t_1) - r c_y (\cos t_2 - \cos t_1) + r^2 (t_2 - t_1) \right]
+$$
+
+For each circle $i$, the program computes the interval of angles
+covered by each circle $j$ that intersects $i$, sorts the intervals
+and integrates along the gaps between them. Circles that can
+intersect $i$ are found by binary search on the circles sorted by
+$x$. Circles that are entirely inside another circle do not
+contribute.
+
+The contribution of each circle depends only on the input, so in this
+case it _is_ correct to partition the circles among the MPI processes
+(round-robin) and the OpenMP threads of each process (dynamically,
+since the cost of each circle depends on the number of neighbors); the
+partial sums are then added with a reduction.
+
 To compile:
 
-        mpicc -std = c99 -Wall -Wpedantic mpi-circles.c -o mpi-circles
+        mpicc -std=c99 -Wall -Wpedantic -fopenmp mpi-circles.c -o mpi-circles -lm
 
 To execute:
 
@@ -84,6 +118,10 @@ For example:
 
         mpirun -n 4 ./mpi-circles 10000 circles-1000.in
 
+To compute the exact area, use `-e` instead of the number of points:
+
+        mpirun -n 4 ./mpi-circles -e circles-1000.in
+
 ## File2
 
 - [mpi-circles.c](mpi-circles.c)
@@ -94,6 +132,8 @@ For example:
 ***/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <time.h> /* for time() */
 #include <assert.h>
 #include <mpi.h>
@@ -105,15 +145,15 @@ float sq(float x)
 }
 
 /* Generate |k| random points inside the square (0,0) --
-  (100,100). Return the number of points that fall inside at least one
+  (1000,1000). Return the number of points that fall inside at least one
   of the |n| circles with center (x[i], y[i]) and radius r[i].  The
   result must be <= |k|. */
 int inside( const float* x, const float* y, const float *r, int n, int k )
 {
     int i, np, c=0;
     for (np=0; np<k; np++) {
-        const float px = 100.0*rand()/(float)RAND_MAX;
-        const float py = 100.0*rand()/(float)RAND_MAX;
+        const float px = 1000.0*rand()/(float)RAND_MAX;
+        const float py = 1000.0*rand()/(float)RAND_MAX;
         for (i=0; i<n; i++) {
             if ( sq(px-x[i]) + sq(py-y[i]) <= sq(r[i]) ) {
                 c++;
@@ -124,11 +164,142 @@ int inside( const float* x, const float* y, const float *r, int n, int k )
     return c;
 }
 
+/* Circle i has center (x[i], y[i]) and radius r[i]; order[] is a
+   permutation of 0 .. n-1 that sorts the circles by x[] */
+typedef struct {
+    const float *x, *y, *r;
+    const int *order;
+    int n;
+    double rmax;        /* largest radius */
+} circles_t;
+
+/* Used by qsort() to sort the circles by the x coordinate */
+const float *sort_x;
+
+int compare_x( const void *p1, const void *p2 )
+{
+    const float a = sort_x[*(const int*)p1], b = sort_x[*(const int*)p2];
+    return (a > b) - (a < b);
+}
+
+/* An interval of angles [lo, hi], -pi <= lo <= hi <= pi */
+typedef struct {
+    double lo, hi;
+} arc_t;
+
+int compare_arcs( const void *p1, const void *p2 )
+{
+    const double a = ((const arc_t*)p1)->lo, b = ((const arc_t*)p2)->lo;
+    return (a > b) - (a < b);
+}
+
+/* Return the first index k of order[] such that x[order[k]] >= v */
+int lower_bound_x( const circles_t *C, double v )
+{
+    int lo = 0, hi = C->n;
+    while (lo < hi) {
+        const int m = (lo + hi) / 2;
+        if (C->x[C->order[m]] < v) lo = m + 1; else hi = m;
+    }
+    return lo;
+}
+
+/*
+ * Return the integral of (x dy - y dx)/2 along the arcs of the
+ * boundary of circle i that are not inside any other circle; by
+ * Green's theorem, the sum over all circles is the area of the union.
+ * The arcs covered by other circles are stored in `*arcs`, an array
+ * of `*maxarcs` elements that is enlarged if needed.
+ */
+double boundary_integral( const circles_t *C, int i, arc_t **arcs, int *maxarcs )
+{
+    const double xi = C->x[i], yi = C->y[i], ri = C->r[i];
+    const double PI = 3.14159265358979323846;
+    /* only circles whose center is at most ri + rmax apart along the
+       x axis can intersect circle i */
+    const int kmin = lower_bound_x(C, xi - ri - C->rmax);
+    const int kmax = lower_bound_x(C, xi + ri + C->rmax);
+    int k, narcs = 0;
+
+    if (ri <= 0.0)
+        return 0.0;
+
+    for (k = kmin; k < kmax; k++) {
+        const int j = C->order[k];
+        const double dx = C->x[j] - xi, dy = C->y[j] - yi, rj = C->r[j];
+        const double d = sqrt(dx*dx + dy*dy);
+
+        if (j == i || d >= ri + rj)
+            continue; /* disjoint */
+        if (d + ri <= rj) {
+            /* i is inside j; of two identical circles, only the one
+               with the smallest index is counted */
+            if (d > 0.0 || ri < rj || j < i)
+                return 0.0;
+            continue;
+        }
+        if (d + rj <= ri)
+            continue; /* j inside i */
+        /* j covers the arc of i centered at angle a, of half-width h */
+        const double a = atan2(dy, dx);
+        const double h = acos((ri*ri + d*d - rj*rj) / (2.0 * ri * d));
+        if (narcs + 2 > *maxarcs) {
+            *maxarcs = 2 * (*maxarcs) + 2;
+            *arcs = (arc_t*)realloc(*arcs, *maxarcs * sizeof(arc_t));
+            assert(*arcs != NULL);
+        }
+        if (a - h < -PI) {
+            (*arcs)[narcs].lo = a - h + 2*PI; (*arcs)[narcs++].hi = PI;
+            (*arcs)[narcs].lo = -PI; (*arcs)[narcs++].hi = a + h;
+        } else if (a + h > PI) {
+            (*arcs)[narcs].lo = a - h; (*arcs)[narcs++].hi = PI;
+            (*arcs)[narcs].lo = -PI; (*arcs)[narcs++].hi = a + h - 2*PI;
+        } else {
+            (*arcs)[narcs].lo = a - h; (*arcs)[narcs++].hi = a + h;
+        }
+    }
+
+    /* integrate along the gaps between the covered arcs */
+    qsort(*arcs, narcs, sizeof(arc_t), compare_arcs);
+    double result = 0.0, t = -PI;
+    for (k = 0; k <= narcs; k++) {
+        const double t1 = (k < narcs ? (*arcs)[k].lo : PI);
+        if (t1 > t) {
+            result += ri * xi * (sin(t1) - sin(t)) - ri * yi * (cos(t1) - cos(t)) + ri * ri * (t1 - t);
+        }
+        if (k < narcs && (*arcs)[k].hi > t)
+            t = (*arcs)[k].hi;
+    }
+    return 0.5 * result;
+}
+
+/* Return the contribution of this process to the exact area of the
+   union of the circles: circles are assigned to processes in
+   round-robin fashion, and to OpenMP threads dynamically */
+double union_area( const circles_t *C, int my_rank, int comm_sz )
+{
+    double area = 0.0;
+    int i;
+
+#pragma omp parallel default(none) shared(C, my_rank, comm_sz) reduction(+:area)
+    {
+        arc_t *arcs = NULL;
+        int maxarcs = 0;
+#pragma omp for schedule(dynamic, 64)
+        for (i = my_rank; i < C->n; i += comm_sz) {
+            area += boundary_integral(C, i, &arcs, &maxarcs);
+        }
+        free(arcs);
+    }
+    return area;
+}
+
 int main( int argc, char* argv[] )
 {
     float *x = NULL, *y = NULL, *r = NULL;
-    int N, K, c = 0;
+    int N, K = 0, c = 0;
     int my_rank, comm_sz;
+    int exact = 0;
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
@@ -138,11 +309,15 @@ int main( int argc, char* argv[] )
     srand(my_rank * 7 + 11);
 
     if ( (0 == my_rank) && (argc != 3) ) {
-        fprintf(stderr, "Usage: %s [npoints] [inputfile]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [npoints | -e] [inputfile]\n", argv[0]);
         MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
 
-    K = atoi(argv[1]);
+    if ( 0 == strcmp(argv[1], "-e") ) {
+        exact = 1;
+    } else {
+        K = atoi(argv[1]);
+    }
 
     /* The input file is read by the master */
     if ( 0 == my_rank ) {
@@ -169,12 +344,13 @@ int main( int argc, char* argv[] )
     }
 
     const double tstart = MPI_Wtime();
-    float local_c;
+    int local_c;
     int local_k = K / comm_sz;
 
 
     /* [TODO] This is not a true parallel version: the master does
        everything */
+    MPI_Bcast(&N, 1, MPI_INT, 0, MPI_COMM_WORLD);
     if ( 0 == my_rank ) {
         local_k += K % comm_sz;
     } else {
@@ -183,11 +359,40 @@ int main( int argc, char* argv[] )
         r = (float*)malloc(N * sizeof(*r)); assert(r != NULL);
     }
 
-    MPI_Bcast(&N, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(x, N, MPI_FLOAT, 0, MPI_COMM_WORLD);
     MPI_Bcast(y, N, MPI_FLOAT, 0, MPI_COMM_WORLD);
     MPI_Bcast(r, N, MPI_FLOAT, 0, MPI_COMM_WORLD);
 
+    if ( exact ) {
+        circles_t C;
+        int *order = (int*)malloc(N * sizeof(*order)); assert(order != NULL);
+        double area, local_area;
+        int i;
+
+        C.x = x; C.y = y; C.r = r; C.n = N; C.order = order;
+        C.rmax = 0.0;
+        for (i=0; i<N; i++) {
+            order[i] = i;
+            C.rmax = (r[i] > C.rmax ? r[i] : C.rmax);
+        }
+        sort_x = x;
+        qsort(order, N, sizeof(*order), compare_x);
+
+        local_area = union_area(&C, my_rank, comm_sz);
+        MPI_Reduce(&local_area, &area, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        if ( 0 == my_rank ) {
+            printf("%d circles, exact area %f\n", N, area);
+            const double elapsed = MPI_Wtime() - tstart;
+            printf("Execution time (s): %f\n", elapsed);
+        }
+        free(order);
+        free(x);
+        free(y);
+        free(r);
+        MPI_Finalize();
+        return EXIT_SUCCESS;
+    }
+
     local_c = inside(x, y, r, N, local_k);
 
     MPI_Reduce(&local_c, &c, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
@@ -0,0 +1,116 @@
+/****************************************************************************
+ *
+ * hpc.h - Miscellaneous utility functions for the HPC course
+ *
+ * Copyright (C) 2017 by Moreno Marzolla <moreno.marzolla(at)unibo.it>
+ * Last modified on 2020-05-23 by Moreno Marzolla
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * --------------------------------------------------------------------------
+ *
+ * This header file provides a function double hpc_gettime() that
+ * returns the elapsed time (in seconds) since "the epoch". The
+ * function uses the timing routing of the underlying parallel
+ * framework (OpenMP or MPI), if enabled; otherwise, the default is to
+ * use the clock_gettime() function.
+ *
+ * IMPORTANT NOTE: to work reliably this header file must be the FIRST
+ * header file that appears in your code.
+ *
+ ****************************************************************************/
+
+#ifndef HPC_H
+#define HPC_H
+
+#if defined(_OPENMP)
+#include <omp.h>
+/******************************************************************************
+ * OpenMP timing routines
+ ******************************************************************************/
+double hpc_gettime( void )
+{
+    return omp_get_wtime();
+}
+
+#elif defined(MPI_Init)
+/******************************************************************************
+ * MPI timing routines
+ ******************************************************************************/
+double hpc_gettime( void )
+{
+    return MPI_Wtime();
+}
+
+#else
+/******************************************************************************
+ * POSIX-based timing routines
+ ******************************************************************************/
+#if _XOPEN_SOURCE < 600
+#define _XOPEN_SOURCE 600
+#endif
+#include <time.h>
+
+double hpc_gettime( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+#endif
+
+#ifdef __CUDACC__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* from https://gist.github.com/ashwin/2652488 */
+
+#define cudaSafeCall( err ) __cudaSafeCall( err, __FILE__, __LINE__ )
+#define cudaCheckError()    __cudaCheckError( __FILE__, __LINE__ )
+
+inline void __cudaSafeCall( cudaError err, const char *file, const int line )
+{
+#ifndef NO_CUDA_CHECK_ERROR
+    if ( cudaSuccess != err ) {
+        fprintf( stderr, "cudaSafeCall() failed at %s:%i : %s\n",
+                 file, line, cudaGetErrorString( err ) );
+        abort();
+    }
+#endif
+}
+
+inline void __cudaCheckError( const char *file, const int line )
+{
+#ifndef NO_CUDA_CHECK_ERROR
+    cudaError err = cudaGetLastError();
+    if ( cudaSuccess != err ) {
+        fprintf( stderr, "cudaCheckError() failed at %s:%i : %s\n",
+                 file, line, cudaGetErrorString( err ) );
+        abort();
+    }
+
+    /* More careful checking. However, this will affect performance.
+       Comment away if needed. */
+    err = cudaDeviceSynchronize();
+    if( cudaSuccess != err ) {
+        fprintf( stderr, "cudaCheckError() with sync failed at %s:%i : %s\n",
+                 file, line, cudaGetErrorString( err ) );
+        abort();
+    }
+#endif
+}
+
+#endif
+
+#endif
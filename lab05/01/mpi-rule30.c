@@ -138,6 +138,11 @@ processes execute the exact same type of communication: therefore,
 each one should call `MPI_Sendrecv()` twice in the same way (possibly
 with different parameters).
 
+If you only need the sequence of values of the center cell (e.g., as
+a source of pseudo-random bits), see
+[omp-rule30-bits.c](omp-rule30-bits.c), that computes only the cells
+that the center column depends on.
+
 To compile:
 
         mpicc -std=c99 -Wall -Wpedantic mpi-rule30.c -o mpi-rule30
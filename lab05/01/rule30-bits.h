@@ -0,0 +1,188 @@
+/****************************************************************************
+ *
+ * rule30-bits.h - Pseudo-random bits from the center column of Rule 30
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * --------------------------------------------------------------------------
+ *
+ * r30_generate(nbits, cb, arg) computes the first `nbits` values
+ * c[0], c[1], ... of the center cell of the Rule 30 CA started from a
+ * single black cell on an infinite white row (c[0] = 1). The bits
+ * are packed into bytes, most significant bit first (c[0] is bit 7
+ * of the first byte), and passed to the callback function
+ *
+ *      cb(bytes, nbytes, arg)
+ *
+ * in chunks of at most R30_CHUNK bytes, in order; the last byte is
+ * padded with zeros if `nbits` is not a multiple of 8.
+ *
+ * Computing c[t] requires the state at time s only for the cells at
+ * distance at most t - s from the center, so the cells that are
+ * simulated are those in the intersection of the forward light cone
+ * of the initial cell and the backward light cone of the last bit:
+ * the active width grows by two cells at each step up to nbits/2
+ * steps, and then shrinks by two cells at each step. The total work
+ * is about nbits^2/2 cell updates.
+ *
+ * Cells are packed 64 per word, so that one step of 64 cells is
+ *
+ *      next = left ^ (center | right)
+ *
+ * on whole words, where `left` and `right` are the word shifted by
+ * one bit with the carry from the adjacent words. Steps are computed
+ * in blocks of 64: the active words are partitioned among OpenMP
+ * threads, and each thread copies its words plus one word on each
+ * side into a private buffer, then performs 64 steps there without
+ * synchronization. The cells that depend on the neighbors' data move
+ * inward by one cell per step, so after 64 steps exactly the copied
+ * halo word is wrong and the thread's own words are correct; the
+ * threads synchronize once every 64 steps, instead of once per step.
+ *
+ * The program must be compiled with -fopenmp; without it, a single
+ * thread is used.
+ *
+ ****************************************************************************/
+
+#ifndef RULE30_BITS_H
+#define RULE30_BITS_H
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* Maximum number of bytes passed to a single call of the callback;
+   must be a multiple of 8 */
+#define R30_CHUNK 4096
+
+typedef void (*r30_callback_t)( const unsigned char *bytes, long nbytes, void *arg );
+
+/* One step of the cells buf[1 .. n]; buf[0] and buf[n+1] are zero */
+void r30_step( const uint64_t * restrict cur, uint64_t * restrict next, long n )
+{
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (long i=1; i<=n; i++) {
+        const uint64_t x = cur[i];
+        const uint64_t left = (x << 1) | (cur[i-1] >> 63);
+        const uint64_t right = (x >> 1) | (cur[i+1] << 63);
+        next[i] = left ^ (x | right);
+    }
+}
+
+void r30_generate( long nbits, r30_callback_t cb, void *arg )
+{
+    /* The row has enough words for the widest light cone, plus one
+       white word on each side that is never updated */
+    const long nwords = 2*((nbits + 128)/64 + 2) + 2;
+    const long C = 64*(nwords/2) + 32; /* index of the center cell */
+    const long CW = C / 64;            /* word containing the center */
+    uint64_t *row = (uint64_t*)calloc(nwords, sizeof(*row));
+    unsigned char *out = (unsigned char*)calloc(R30_CHUNK, 1);
+    long nout = 0; /* bytes of out[] already filled */
+    assert(row != NULL && out != NULL);
+
+    row[CW] = ((uint64_t)1) << (C % 64);
+
+#ifdef _OPENMP
+#pragma omp parallel default(none) shared(row, out, nout, nbits, nwords, C, CW, cb, arg)
+#endif
+    {
+#ifdef _OPENMP
+        const int P = omp_get_num_threads();
+        const int p = omp_get_thread_num();
+#else
+        const int P = 1, p = 0;
+#endif
+        /* Private buffers; the chunk of a thread never exceeds
+           nwords/P + 1 words */
+        const long bufsize = nwords/P + 5;
+        uint64_t *buf[2];
+        buf[0] = (uint64_t*)malloc(bufsize * sizeof(uint64_t));
+        buf[1] = (uint64_t*)malloc(bufsize * sizeof(uint64_t));
+        assert(buf[0] != NULL && buf[1] != NULL);
+
+        for (long t0 = 0; t0 < nbits; t0 += 64) {
+            /* Radius of the cells that are updated during this block
+               of steps (see the comment at the top of this file):
+               while the light cone of the initial cell is narrower
+               than that of the last bit, update the whole cone;
+               after that, update the cells that the remaining bits
+               depend on, plus the 64 cells that become wrong during
+               the block. */
+            const long rad = (t0 + 128 < nbits - t0 + 64 ? t0 + 128 : nbits - t0 + 64);
+            long lo = (C - rad) / 64, hi = (C + rad) / 64 + 1;
+            lo = (lo < 1 ? 1 : lo);
+            hi = (hi > nwords - 1 ? nwords - 1 : hi);
+            const long a = lo + (hi - lo) * p / P;
+            const long b = lo + (hi - lo) * (p + 1) / P;
+            const long n = b - a + 2; /* own words plus halo */
+            int cur = 0;
+
+            if (a < b) {
+                buf[cur][0] = buf[cur][n+1] = 0;
+                buf[1-cur][0] = buf[1-cur][n+1] = 0;
+                memcpy(&buf[cur][1], &row[a-1], n * sizeof(uint64_t));
+            }
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+            if (a < b) {
+                const int has_center = (a <= CW && CW < b);
+                uint64_t bits = 0;
+                for (int s=0; s<64; s++) {
+                    if (has_center) {
+                        bits = (bits << 1) | ((buf[cur][CW - a + 2] >> (C % 64)) & 1);
+                    }
+                    r30_step(buf[cur], buf[1-cur], n);
+                    cur = 1 - cur;
+                }
+                memcpy(&row[a], &buf[cur][2], (b - a) * sizeof(uint64_t));
+                if (has_center) {
+                    for (int k=0; k<8; k++) {
+                        out[nout + k] = (unsigned char)(bits >> (56 - 8*k));
+                    }
+                }
+            }
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+            {
+                nout += 8;
+                if (t0 + 64 >= nbits) {
+                    /* last block: clear the bits beyond nbits */
+                    const long nbytes = nout - 8 + (nbits - t0 + 7) / 8;
+                    if (nbits % 8) {
+                        out[nbytes - 1] &= (unsigned char)(0xff << (8 - nbits % 8));
+                    }
+                    cb(out, nbytes, arg);
+                } else if (nout == R30_CHUNK) {
+                    cb(out, nout, arg);
+                    nout = 0;
+                }
+            }
+        }
+        free(buf[0]);
+        free(buf[1]);
+    }
+    free(row);
+    free(out);
+}
+
+#endif
@@ -24,6 +24,13 @@
  * To generate 1000 random rectangles, run:
  * ./bbox-gen 1000 > bbox-1000.in
  *
+ * The corners of each rectangle are chosen uniformly at random in
+ * [0, 1000] x [0, 1000], so that rectangles are large and overlap
+ * heavily. An optional second argument `maxside` generates instead
+ * rectangles whose sides are uniform in [0, maxside], placed at random
+ * inside the same square, e.g.:
+ * ./bbox-gen 1000000 5 > bbox-small.in
+ *
  ****************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,15 +55,26 @@ void compare_and_swap( float *x, float *y )
 int main( int argc, char* argv[] )
 {
     int i, n;
-    if ( argc != 2 ) {
-        printf("Usage: %s n\n", argv[0]);
+    float maxside = -1;
+    if ( argc < 2 || argc > 3 ) {
+        printf("Usage: %s n [maxside]\n", argv[0]);
         return EXIT_FAILURE;
     }
     n = atoi( argv[1] );
+    if ( argc > 2 ) {
+        maxside = atof( argv[2] );
+    }
     printf("%d\n", n);
     for (i=0; i<n; i++) {
-        float x1 = randab(0, 1000), x2 = randab(0, 1000);
-        float y1 = randab(0, 1000), y2 = randab(0, 1000);
+        float x1, y1, x2, y2;
+        if ( maxside < 0 ) {
+            x1 = randab(0, 1000); x2 = randab(0, 1000);
+            y1 = randab(0, 1000); y2 = randab(0, 1000);
+        } else {
+            const float w = randab(0, maxside), h = randab(0, maxside);
+            x1 = randab(0, 1000 - w); x2 = x1 + w;
+            y1 = randab(0, 1000 - h); y2 = y1 + h;
+        }
         compare_and_swap(&x1, &x2);
         compare_and_swap(&y1, &y2);
         printf("%f %f %f %f\n", x1, y2, x2, y1);
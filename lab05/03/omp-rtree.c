@@ -0,0 +1,650 @@
+/****************************************************************************
+ *
+ * omp-rtree.c - Batched spatial queries on a packed Hilbert R-tree
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ****************************************************************************/
+
+/***
+% HPC - Spatial queries on a packed Hilbert R-tree
+% Last updated: 2026-10-18
+
+[mpi-bbox.c](mpi-bbox.c) computes the bounding box of a set of
+rectangles read from a file. This program uses the same input files
+to build a spatial index, and answers large batches of queries on
+it. Three kinds of queries are supported:
+
+- _window_: report the rectangles that are entirely contained in a
+  given query rectangle (the window);
+
+- _intersection_: report the rectangles that intersect a given query
+  rectangle;
+
+- _point_: report the rectangles that contain a given point.
+
+Since the program only needs to compare the results with a brute
+force search, a query "reports" the number of rectangles found and
+the sum of their indexes.
+
+## The index
+
+An _R-tree_ is a balanced tree where each node stores up to $B$
+rectangles (the _fanout_): the entries of a leaf are the input
+rectangles, while each entry of an internal node is the bounding box
+of a child. A query visits the children whose bounding box can
+contain some result, starting from the root.
+
+Since the rectangles are known in advance, the tree is _bulk-loaded_
+bottom-up instead of being built by insertions ("packed" R-tree,
+Kamel and Faloutsos, 1993):
+
+1. The center of each rectangle is mapped to a grid of $2^{16} \times
+   2^{16}$ cells covering the bounding box of the input, and the cell
+   is mapped to its position along the _Hilbert curve_ that visits the
+   whole grid. Rectangles that are close on the curve are close in
+   the plane.
+
+2. The rectangles are sorted by Hilbert key with a parallel LSD radix
+   sort (4 passes of 8 bits, with per-thread histograms).
+
+3. Groups of $B$ consecutive rectangles form the leaves, groups of
+   $B$ consecutive leaves form the nodes of the next level, and so
+   on up to the root. All nodes of a level are filled in parallel.
+
+All the nodes are full except the last of each level, so the tree
+has the minimum height and the highest occupancy.
+
+The fanout is $B = 8$, and the coordinates of the entries of each
+node are stored as four vectors of 8 floats (`xlo`, `ylo`, `xhi`,
+`yhi`), so that the test of a query against all the entries of a node
+takes four vector comparisons and a few bitwise operations; the
+result is a bit mask of the entries to visit (or to report). Unused
+entries hold an empty box ($+\infty$ as lower corner and $-\infty$ as
+upper corner), that never intersects anything.
+
+## Batches of queries
+
+`rt_query_batch()` answers an array of queries of the same kind. The
+queries are first sorted by the Hilbert key of their center, so that
+consecutive queries visit mostly the same nodes, that are then likely
+to be in the cache; the sorted queries are assigned to the OpenMP
+threads in chunks with dynamic scheduling, since the cost of a query
+varies widely. Each query is processed with an explicit stack, and
+its results are stored in the position of the query in the original
+batch.
+
+The program generates `nq` random queries of each kind (default
+100000): points are uniform in the bounding box of the input; the
+sides of windows and intersection queries are uniform in $[0, s]$,
+where $s$ is 1% of the largest side of the bounding box unless
+specified on the command line. For each kind, the program prints the
+average number of results per query and the throughput in queries/s;
+the first queries of each batch are checked against a brute force
+search.
+
+The input files [bbox-1000.in](bbox-1000.in) to
+[bbox-100000.in](bbox-100000.in) contain very large rectangles, so
+that every point is covered by a sizable fraction of the input and
+an index is of limited help. Inputs with smaller rectangles, where
+queries visit a small fraction of the tree, can be created with the
+optional second argument of [bbox-gen.c](bbox-gen.c):
+
+        ./bbox-gen 1000000 5 > bbox-small.in
+
+To compile:
+
+        gcc -std=c99 -Wall -Wpedantic -O2 -march=native -fopenmp omp-rtree.c -o omp-rtree
+
+To execute:
+
+        ./omp-rtree FILE [nq [s]]
+
+Example:
+
+        OMP_NUM_THREADS=4 ./omp-rtree bbox-100000.in 100000 10
+
+## Files
+
+- [omp-rtree.c](omp-rtree.c)
+- [bbox-gen.c](bbox-gen.c)
+- [bbox-1000.in](bbox-1000.in)
+- [bbox-10000.in](bbox-10000.in)
+- [bbox-100000.in](bbox-100000.in)
+- [hpc.h](hpc.h)
+
+***/
+
+/* The following #define is required by posix_memalign() and MUST
+   appear before including any system header */
+#define _XOPEN_SOURCE 600
+
+#include "hpc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <omp.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+/* Fanout; the entries of a node fill one vector */
+#define RT_FANOUT 8
+
+/* Maximum height of the tree; 8^10 rectangles are more than enough */
+#define RT_MAX_HEIGHT 10
+
+/* Number of queries of each kind checked against the brute force
+   search */
+#define NCHECK 200
+
+typedef float v8f __attribute__((vector_size(32)));
+typedef int v8i __attribute__((vector_size(32)));
+
+typedef struct {
+    v8f xlo, ylo, xhi, yhi; /* boxes of the entries                */
+    int child[RT_FANOUT];   /* child node, or index of a rectangle */
+    int n;                  /* number of entries in use            */
+} rt_node_t;
+
+/* Nodes are stored level by level starting from the leaves, so that
+   node i is a leaf iff i < nleaves; the root is the last node. */
+typedef struct {
+    rt_node_t *nodes;
+    int nnodes;
+    int nleaves;
+    int height;
+    float bx0, by0, bx1, by1; /* bounding box of all rectangles */
+} rtree_t;
+
+typedef enum { Q_WINDOW, Q_INTERSECT, Q_POINT } qkind_t;
+
+/* A query rectangle; for point queries, xlo == xhi and ylo == yhi */
+typedef struct {
+    float xlo, ylo, xhi, yhi;
+} query_t;
+
+/* Result of a query: number of rectangles found, and the sum of
+   their indexes */
+typedef struct {
+    long count;
+    long idsum;
+} result_t;
+
+/**
+ * Position of cell (x, y) of a 2^16 x 2^16 grid along the Hilbert
+ * curve that starts at (0, 0) and ends at (2^16 - 1, 0).
+ */
+uint32_t hilbert( uint32_t x, uint32_t y )
+{
+    const uint32_t n = 1u << 16;
+    uint32_t d = 0;
+    for (uint32_t s = n/2; s > 0; s /= 2) {
+        const uint32_t rx = (x & s) > 0;
+        const uint32_t ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        /* rotate the quadrant */
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            const uint32_t tmp = x; x = y; y = tmp;
+        }
+    }
+    return d;
+}
+
+/* Hilbert key of point (x, y) with respect to the bounding box of
+   tree `t` */
+uint32_t hilbert_key( const rtree_t *t, float x, float y )
+{
+    const float w = t->bx1 - t->bx0, h = t->by1 - t->by0;
+    float fx = (w > 0 ? (x - t->bx0) / w : 0.0f);
+    float fy = (h > 0 ? (y - t->by0) / h : 0.0f);
+    fx = fminf(fmaxf(fx, 0.0f), 1.0f);
+    fy = fminf(fmaxf(fy, 0.0f), 1.0f);
+    return hilbert((uint32_t)(fx * 65535.0f), (uint32_t)(fy * 65535.0f));
+}
+
+/**
+ * Sort idx[0 .. n-1] by increasing key[] with a stable LSD radix sort
+ * (4 passes of 8 bits); key[] is permuted together with idx[]. Each
+ * thread counts the digits of a block of the input, and then moves
+ * its elements to positions that follow those of the same digit in
+ * the blocks of the threads with lower index. Must be called outside
+ * a parallel region; the team may have fewer threads than requested
+ * (e.g., with OMP_DYNAMIC), so blocks are computed from the actual
+ * team size.
+ */
+void radix_sort( uint32_t *key, int *idx, int n )
+{
+    uint32_t *key2 = (uint32_t*)malloc(n * sizeof(*key2));
+    int *idx2 = (int*)malloc(n * sizeof(*idx2));
+    const int P = omp_get_max_threads();
+    long (*hist)[256] = (long(*)[256])malloc(P * sizeof(*hist));
+    assert(key2 != NULL && idx2 != NULL && hist != NULL);
+
+    for (int shift = 0; shift < 32; shift += 8) {
+#pragma omp parallel num_threads(P) default(none) shared(key, idx, key2, idx2, hist, n, shift, P)
+        {
+            const int T = omp_get_num_threads(); /* T <= P */
+            const int p = omp_get_thread_num();
+            const int lo = (long)n * p / T, hi = (long)n * (p + 1) / T;
+            long *h = hist[p];
+
+            for (int d=0; d<256; d++) {
+                h[d] = 0;
+            }
+            for (int i=lo; i<hi; i++) {
+                h[(key[i] >> shift) & 0xff]++;
+            }
+#pragma omp barrier
+#pragma omp single
+            {
+                /* exclusive prefix sum, digit-major, thread-minor */
+                long sum = 0;
+                for (int d=0; d<256; d++) {
+                    for (int q=0; q<T; q++) {
+                        const long c = hist[q][d];
+                        hist[q][d] = sum;
+                        sum += c;
+                    }
+                }
+            }
+            for (int i=lo; i<hi; i++) {
+                const long pos = h[(key[i] >> shift) & 0xff]++;
+                key2[pos] = key[i];
+                idx2[pos] = idx[i];
+            }
+        }
+        uint32_t *tk = key; key = key2; key2 = tk;
+        int *ti = idx; idx = idx2; idx2 = ti;
+    }
+    /* after an even number of passes, the result is in the caller's
+       arrays and key2, idx2 are the buffers allocated above */
+    free(key2);
+    free(idx2);
+    free(hist);
+}
+
+/* Copy entry `j` of node `dst` from the box (xlo, ylo, xhi, yhi) */
+void set_entry( rt_node_t *dst, int j, float xlo, float ylo, float xhi, float yhi, int child )
+{
+    dst->xlo[j] = xlo;
+    dst->ylo[j] = ylo;
+    dst->xhi[j] = xhi;
+    dst->yhi[j] = yhi;
+    dst->child[j] = child;
+}
+
+/* Make all entries of node `dst` empty */
+void clear_node( rt_node_t *dst )
+{
+    for (int j=0; j<RT_FANOUT; j++) {
+        set_entry(dst, j, INFINITY, INFINITY, -INFINITY, -INFINITY, -1);
+    }
+    dst->n = 0;
+}
+
+/**
+ * Bulk-load a packed Hilbert R-tree from the `n` rectangles
+ * [xlo[i], xhi[i]] x [ylo[i], yhi[i]].
+ */
+void rt_build( rtree_t *t, const float *xlo, const float *ylo,
+               const float *xhi, const float *yhi, int n )
+{
+    uint32_t *key = (uint32_t*)malloc(n * sizeof(*key));
+    int *idx = (int*)malloc(n * sizeof(*idx));
+    int level_size[RT_MAX_HEIGHT];
+    float bx0 = INFINITY, by0 = INFINITY, bx1 = -INFINITY, by1 = -INFINITY;
+    assert(key != NULL && idx != NULL);
+    assert(n > 0);
+
+#pragma omp parallel for default(none) shared(xlo, ylo, xhi, yhi, n) reduction(min:bx0, by0) reduction(max:bx1, by1)
+    for (int i=0; i<n; i++) {
+        bx0 = fminf(bx0, xlo[i]);
+        by0 = fminf(by0, ylo[i]);
+        bx1 = fmaxf(bx1, xhi[i]);
+        by1 = fmaxf(by1, yhi[i]);
+    }
+    t->bx0 = bx0; t->by0 = by0; t->bx1 = bx1; t->by1 = by1;
+
+#pragma omp parallel for default(none) shared(t, key, idx, xlo, ylo, xhi, yhi, n)
+    for (int i=0; i<n; i++) {
+        key[i] = hilbert_key(t, (xlo[i] + xhi[i])/2, (ylo[i] + yhi[i])/2);
+        idx[i] = i;
+    }
+    radix_sort(key, idx, n);
+
+    /* Size of each level */
+    int total = 0, m = n;
+    t->height = 0;
+    do {
+        m = (m + RT_FANOUT - 1) / RT_FANOUT;
+        assert(t->height < RT_MAX_HEIGHT);
+        level_size[t->height++] = m;
+        total += m;
+    } while (m > 1);
+
+    const int ret = posix_memalign((void**)&t->nodes, 64, total * sizeof(rt_node_t));
+    assert(0 == ret);
+    t->nnodes = total;
+    t->nleaves = level_size[0];
+
+    /* Leaves */
+    const int nleaves = t->nleaves;
+    rt_node_t *nodes = t->nodes;
+#pragma omp parallel for default(none) shared(nodes, nleaves, idx, xlo, ylo, xhi, yhi, n)
+    for (int k=0; k<nleaves; k++) {
+        rt_node_t *dst = &nodes[k];
+        clear_node(dst);
+        for (int j=0; j<RT_FANOUT && k*RT_FANOUT + j < n; j++) {
+            const int i = idx[k*RT_FANOUT + j];
+            set_entry(dst, j, xlo[i], ylo[i], xhi[i], yhi[i], i);
+            dst->n++;
+        }
+    }
+
+    /* Internal levels; the entries of a node are the bounding boxes
+       of consecutive nodes of the level below */
+    int below = 0; /* index of the first node of the level below */
+    for (int l=1; l<t->height; l++) {
+        const int first = below + level_size[l-1];
+        const int nbelow = level_size[l-1];
+        const int nlevel = level_size[l];
+#pragma omp parallel for default(none) shared(nodes, first, below, nbelow, nlevel)
+        for (int k=0; k<nlevel; k++) {
+            rt_node_t *dst = &nodes[first + k];
+            clear_node(dst);
+            for (int j=0; j<RT_FANOUT && k*RT_FANOUT + j < nbelow; j++) {
+                const int c = below + k*RT_FANOUT + j;
+                const rt_node_t *src = &nodes[c];
+                float cx0 = INFINITY, cy0 = INFINITY, cx1 = -INFINITY, cy1 = -INFINITY;
+                /* empty entries do not change the bounding box */
+                for (int e=0; e<RT_FANOUT; e++) {
+                    cx0 = fminf(cx0, src->xlo[e]);
+                    cy0 = fminf(cy0, src->ylo[e]);
+                    cx1 = fmaxf(cx1, src->xhi[e]);
+                    cy1 = fmaxf(cy1, src->yhi[e]);
+                }
+                set_entry(dst, j, cx0, cy0, cx1, cy1, c);
+                dst->n++;
+            }
+        }
+        below = first;
+    }
+    free(key);
+    free(idx);
+}
+
+void rt_free( rtree_t *t )
+{
+    free(t->nodes);
+    t->nodes = NULL;
+}
+
+/* Bit j of the result is 1 iff lane j of `m` is nonzero */
+static inline unsigned to_bits( v8i m )
+{
+#if defined(__AVX__)
+    return (unsigned)_mm256_movemask_ps((__m256)m);
+#else
+    unsigned bits = 0;
+    for (int j=0; j<RT_FANOUT; j++) {
+        bits |= (m[j] != 0) << j;
+    }
+    return bits;
+#endif
+}
+
+/* Entries of node `nd` whose box intersects `q` */
+static inline unsigned node_intersect( const rt_node_t *nd, const query_t *q )
+{
+    const v8f qxlo = {q->xlo, q->xlo, q->xlo, q->xlo, q->xlo, q->xlo, q->xlo, q->xlo};
+    const v8f qylo = {q->ylo, q->ylo, q->ylo, q->ylo, q->ylo, q->ylo, q->ylo, q->ylo};
+    const v8f qxhi = {q->xhi, q->xhi, q->xhi, q->xhi, q->xhi, q->xhi, q->xhi, q->xhi};
+    const v8f qyhi = {q->yhi, q->yhi, q->yhi, q->yhi, q->yhi, q->yhi, q->yhi, q->yhi};
+    const v8i m = (nd->xlo <= qxhi) & (qxlo <= nd->xhi) &
+        (nd->ylo <= qyhi) & (qylo <= nd->yhi);
+    return to_bits(m);
+}
+
+/* Entries of node `nd` whose box is contained in `q`; empty entries
+   are excluded by the caller */
+static inline unsigned node_inside( const rt_node_t *nd, const query_t *q )
+{
+    const v8f qxlo = {q->xlo, q->xlo, q->xlo, q->xlo, q->xlo, q->xlo, q->xlo, q->xlo};
+    const v8f qylo = {q->ylo, q->ylo, q->ylo, q->ylo, q->ylo, q->ylo, q->ylo, q->ylo};
+    const v8f qxhi = {q->xhi, q->xhi, q->xhi, q->xhi, q->xhi, q->xhi, q->xhi, q->xhi};
+    const v8f qyhi = {q->yhi, q->yhi, q->yhi, q->yhi, q->yhi, q->yhi, q->yhi, q->yhi};
+    const v8i m = (qxlo <= nd->xlo) & (nd->xhi <= qxhi) &
+        (qylo <= nd->ylo) & (nd->yhi <= qyhi);
+    return to_bits(m);
+}
+
+/**
+ * Answer query `q` of kind `kind`. Point queries are intersection
+ * queries with a degenerate rectangle. Internal nodes are pruned with
+ * the intersection test for all kinds, since a rectangle contained in
+ * the window also intersects it.
+ */
+result_t rt_query( const rtree_t *t, qkind_t kind, const query_t *q )
+{
+    int stack[RT_MAX_HEIGHT * RT_FANOUT];
+    int top = 0;
+    result_t r = {0, 0};
+
+    stack[top++] = t->nnodes - 1;
+    while (top > 0) {
+        const rt_node_t *nd = &t->nodes[stack[--top]];
+        unsigned bits = node_intersect(nd, q);
+        if (nd - t->nodes < t->nleaves) {
+            if (kind == Q_WINDOW) {
+                bits = node_inside(nd, q) & ((1u << nd->n) - 1);
+            }
+            while (bits) {
+                const int j = __builtin_ctz(bits);
+                r.count++;
+                r.idsum += nd->child[j];
+                bits &= bits - 1;
+            }
+        } else {
+            while (bits) {
+                const int j = __builtin_ctz(bits);
+                stack[top++] = nd->child[j];
+                bits &= bits - 1;
+            }
+        }
+    }
+    return r;
+}
+
+/**
+ * Answer the `nq` queries q[] of kind `kind`; the result of q[i] is
+ * stored in res[i]. The queries are processed in the Hilbert order
+ * of their centers.
+ */
+void rt_query_batch( const rtree_t *t, qkind_t kind, const query_t *q, int nq, result_t *res )
+{
+    uint32_t *key = (uint32_t*)malloc(nq * sizeof(*key));
+    int *order = (int*)malloc(nq * sizeof(*order));
+    assert(key != NULL && order != NULL);
+
+#pragma omp parallel for default(none) shared(t, q, nq, key, order)
+    for (int i=0; i<nq; i++) {
+        key[i] = hilbert_key(t, (q[i].xlo + q[i].xhi)/2, (q[i].ylo + q[i].yhi)/2);
+        order[i] = i;
+    }
+    radix_sort(key, order, nq);
+
+#pragma omp parallel for schedule(dynamic, 64) default(none) shared(t, kind, q, nq, res, order)
+    for (int k=0; k<nq; k++) {
+        const int i = order[k];
+        res[i] = rt_query(t, kind, &q[i]);
+    }
+    free(key);
+    free(order);
+}
+
+/* Answer query `q` by examining all the `n` rectangles */
+result_t brute_force( qkind_t kind, const query_t *q,
+                      const float *xlo, const float *ylo,
+                      const float *xhi, const float *yhi, int n )
+{
+    result_t r = {0, 0};
+    for (int i=0; i<n; i++) {
+        int found;
+        if (kind == Q_WINDOW) {
+            found = (q->xlo <= xlo[i] && xhi[i] <= q->xhi &&
+                     q->ylo <= ylo[i] && yhi[i] <= q->yhi);
+        } else {
+            found = (xlo[i] <= q->xhi && q->xlo <= xhi[i] &&
+                     ylo[i] <= q->yhi && q->ylo <= yhi[i]);
+        }
+        if (found) {
+            r.count++;
+            r.idsum += i;
+        }
+    }
+    return r;
+}
+
+/* Uniform random number in [0, 1) from the xorshift64* generator */
+double rng_uniform( uint64_t *state )
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Fill q[0 .. nq-1] with random queries of kind `kind` in the
+   bounding box of `t`; `side` is the maximum side of a window */
+void random_queries( const rtree_t *t, qkind_t kind, query_t *q, int nq, float side, uint64_t seed )
+{
+    const float w = t->bx1 - t->bx0, h = t->by1 - t->by0;
+    uint64_t state = seed;
+    for (int i=0; i<nq; i++) {
+        const float x = t->bx0 + w * rng_uniform(&state);
+        const float y = t->by0 + h * rng_uniform(&state);
+        q[i].xlo = q[i].xhi = x;
+        q[i].ylo = q[i].yhi = y;
+        if (kind != Q_POINT) {
+            q[i].xhi += side * rng_uniform(&state);
+            q[i].yhi += side * rng_uniform(&state);
+        }
+    }
+}
+
+int main( int argc, char* argv[] )
+{
+    const char *kind_name[] = {"window", "intersection", "point"};
+    float *xlo, *ylo, *xhi, *yhi;
+    int N, nq = 100000;
+    float side = -1;
+    rtree_t tree;
+    int ok = 1;
+
+    if ( argc < 2 || argc > 4 ) {
+        fprintf(stderr, "Usage: %s inputfile [nq [s]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if ( argc > 2 ) {
+        nq = atoi(argv[2]);
+    }
+    if ( argc > 3 ) {
+        side = atof(argv[3]);
+    }
+    if ( nq <= 0 ) {
+        fprintf(stderr, "FATAL: nq must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = fopen(argv[1], "r");
+    if ( in == NULL ) {
+        fprintf(stderr, "Cannot open %s for reading\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    if ( 1 != fscanf(in, "%d", &N) || N <= 0 ) {
+        fprintf(stderr, "FATAL: cannot read number of boxes\n");
+        return EXIT_FAILURE;
+    }
+    xlo = (float*)malloc(N * sizeof(*xlo)); assert(xlo != NULL);
+    ylo = (float*)malloc(N * sizeof(*ylo)); assert(ylo != NULL);
+    xhi = (float*)malloc(N * sizeof(*xhi)); assert(xhi != NULL);
+    yhi = (float*)malloc(N * sizeof(*yhi)); assert(yhi != NULL);
+    for (int i=0; i<N; i++) {
+        float x1, y1, x2, y2;
+        /* (x1, y1) is the top left, (x2, y2) the bottom right corner */
+        if ( 4 != fscanf(in, "%f %f %f %f", &x1, &y1, &x2, &y2) ) {
+            fprintf(stderr, "FATAL: cannot read box %d\n", i);
+            return EXIT_FAILURE;
+        }
+        xlo[i] = fminf(x1, x2); xhi[i] = fmaxf(x1, x2);
+        ylo[i] = fminf(y1, y2); yhi[i] = fmaxf(y1, y2);
+    }
+    fclose(in);
+
+    double tstart = hpc_gettime();
+    rt_build(&tree, xlo, ylo, xhi, yhi, N);
+    const double tbuild = hpc_gettime() - tstart;
+
+    if ( side < 0 ) {
+        side = 0.01f * fmaxf(tree.bx1 - tree.bx0, tree.by1 - tree.by0);
+    }
+
+    printf("Rectangles: %d\n", N);
+    printf("Threads: %d\n", omp_get_max_threads());
+    printf("Tree: %d nodes, %d leaves, height %d\n", tree.nnodes, tree.nleaves, tree.height);
+    printf("Build time (s): %f\n", tbuild);
+    printf("Queries: %d of each kind, window side <= %f\n\n", nq, side);
+    printf("Kind            Avg results  Time (s)    Queries/s   Check\n");
+
+    query_t *q = (query_t*)malloc(nq * sizeof(*q));
+    result_t *res = (result_t*)malloc(nq * sizeof(*res));
+    assert(q != NULL && res != NULL);
+    for (qkind_t kind = Q_WINDOW; kind <= Q_POINT; kind++) {
+        random_queries(&tree, kind, q, nq, side, 0x9E3779B97F4A7C15ULL + kind);
+        tstart = hpc_gettime();
+        rt_query_batch(&tree, kind, q, nq, res);
+        const double elapsed = hpc_gettime() - tstart;
+
+        long nres = 0;
+        for (int i=0; i<nq; i++) {
+            nres += res[i].count;
+        }
+        int kind_ok = 1;
+        for (int i=0; i<nq && i<NCHECK; i++) {
+            const result_t r = brute_force(kind, &q[i], xlo, ylo, xhi, yhi, N);
+            kind_ok = kind_ok && (r.count == res[i].count) && (r.idsum == res[i].idsum);
+        }
+        ok = ok && kind_ok;
+        printf("%-14s %12.2f  %8.4f  %11.0f   %s\n", kind_name[kind],
+               (double)nres / nq, elapsed, nq / elapsed, kind_ok ? "OK" : "FAILED");
+    }
+
+    rt_free(&tree);
+    free(q);
+    free(res);
+    free(xlo);
+    free(ylo);
+    free(xhi);
+    free(yhi);
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -88,6 +88,11 @@ To compile:
 
         nvcc cuda-dot.cu -o cuda-dot -lm
 
+To compile as a multithreaded CPU program, on a machine without an
+NVidia GPU (see [cuda-cpu.h](cuda-cpu.h)):
+
+        g++ -x c++ -fopenmp -O2 cuda-dot.cu -o cuda-dot -lm
+
 To execute:
 
         ./cuda-dot [len]
@@ -100,9 +105,11 @@ Example:
 
 - [cuda-dot.cu](cuda-dot.cu)
 - [hpc.h](hpc.h)
+- [cuda-cpu.h](cuda-cpu.h)
 
 ***/
 #include "../hpc.h"
+#include "../cuda-cpu.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -136,7 +143,7 @@ double dot( double *x, double *y, int n )
     cudaMemcpy(d_y, y, SIZE_XY, cudaMemcpyHostToDevice);
     
     /* eseguire il kernel */
-    dot_kernel<<<1, BLKDIM>>>(d_x, d_y, n, d_tmp);
+    KERNEL_LAUNCH(dot_kernel, 1, BLKDIM, d_x, d_y, n, d_tmp);
     cudaCheckError();
 
     /* riduzione da fare a mmano */
@@ -50,6 +50,11 @@ To copmile:
 
         nvcc cuda-reverse.cu -o cuda-reverse
 
+To compile as a multithreaded CPU program, on a machine without an
+NVidia GPU (see [cuda-cpu.h](cuda-cpu.h)):
+
+        g++ -x c++ -fopenmp -O2 cuda-reverse.cu -o cuda-reverse
+
 To execute:
 
         ./cuda-reverse [n]
@@ -62,9 +67,11 @@ Example:
 
 - [cuda-reverse.cu](cuda-reverse.cu)
 - [hpc.h](hpc.h)
+- [cuda-cpu.h](cuda-cpu.h)
 
 ***/
 #include "../hpc.h"
+#include "../cuda-cpu.h"
 #include <stdio.h>
 #include <math.h>
 #include <assert.h>
@@ -90,7 +97,7 @@ void reverse( int *in, int *out, int n )
 
     cudaSafeCall(cudaMemcpy(d_in, in, size, cudaMemcpyHostToDevice));
 
-    reverse_kernel<<<(n + BLKDIM - 1)/BLKDIM, BLKDIM>>>(d_in, d_out, n);
+    KERNEL_LAUNCH(reverse_kernel, (n + BLKDIM - 1)/BLKDIM, BLKDIM, d_in, d_out, n);
 
     cudaSafeCall(cudaMemcpy(out, d_out, size, cudaMemcpyDeviceToHost));
 
@@ -116,7 +123,7 @@ void inplace_reverse( int *in, int n )
 	cudaSafeCall( cudaMalloc( (void **)&d_in, size) );	
 	cudaSafeCall( cudaMemcpy(d_in, in, size, cudaMemcpyHostToDevice) );
 
-	reverse_kernel_inplace<<<(n + BLKDIM - 1)/BLKDIM, BLKDIM>>>(d_in, n);
+	KERNEL_LAUNCH(reverse_kernel_inplace, (n + BLKDIM - 1)/BLKDIM, BLKDIM, d_in, n);
 
 	cudaSafeCall(cudaMemcpy(in, d_in, size, cudaMemcpyDeviceToHost));
 
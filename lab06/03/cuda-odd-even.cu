@@ -90,6 +90,11 @@ Compile with:
 
         nvcc cuda-odd-even.cu -o cuda-odd-even
 
+To compile as a multithreaded CPU program, on a machine without an
+NVidia GPU (see [cuda-cpu.h](cuda-cpu.h)):
+
+        g++ -x c++ -fopenmp -O2 cuda-odd-even.cu -o cuda-odd-even
+
 Execute with:
 
         ./cuda-odd-even [len]
@@ -102,9 +107,11 @@ Example:
 
 - [cuda-odd-even.cu](cuda-odd-even.cu)
 - [hpc.h](hpc.h)
+- [cuda-cpu.h](cuda-cpu.h)
 
  ***/
 #include "../hpc.h"
+#include "../cuda-cpu.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -138,7 +145,7 @@ void odd_even_sort( int* v, int n )
 	cudaSafeCall(cudaMemcpy(d_v, v, n*sizeof(*v), cudaMemcpyHostToDevice));
 
     for (int phase = 0; phase < n; phase++) {
-		odd_even_step<<<(BLKLEN + n - 1) / BLKLEN, BLKLEN>>>(d_v, n, phase);
+		KERNEL_LAUNCH(odd_even_step, (BLKLEN + n - 1) / BLKLEN, BLKLEN, d_v, n, phase);
     }
 
 	cudaSafeCall(cudaMemcpy(v, d_v, n*sizeof(*v), cudaMemcpyDeviceToHost));
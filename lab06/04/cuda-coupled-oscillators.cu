@@ -86,6 +86,11 @@ Per compilare:
 
         nvcc cuda-coupled-oscillators.cu -o cuda-coupled-oscillators -lm
 
+To compile as a multithreaded CPU program, on a machine without an
+NVidia GPU (see [cuda-cpu.h](cuda-cpu.h)):
+
+        g++ -x c++ -fopenmp -O2 cuda-coupled-oscillators.cu -o cuda-coupled-oscillators -lm
+
 Per eseguire:
 
         ./cuda-coupled-oscillators [N]
@@ -98,9 +103,11 @@ Esempio:
 
 - [cuda-coupled-oscillators.cu](cuda-coupled-oscillators.cu)
 - [hpc.h](hpc.h)
+- [cuda-cpu.h](cuda-cpu.h)
 
  ***/
 #include "../hpc.h"
+#include "../cuda-cpu.h"
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
@@ -146,6 +153,9 @@ void init( float *x, float *v, int n )
 __global__ void step_kernel( float *x, float *v, float *xnext, float *vnext, int n) {
 	const int i = threadIdx.x + blockIdx.x * blockDim.x;
 
+	if ( i >= n ) {
+		return;
+	}
 	if ( i > 0 && i < n - 1 ) {
 		/* Compute the net force acting on mass i */
 		const float F = k*(x[i-1] - 2*x[i] + x[i+1]);
@@ -177,11 +187,16 @@ void step( float *x, float *v, float *xnext, float *vnext, int n )
 	cudaSafeCall( cudaMemcpy( d_x, x, size, cudaMemcpyHostToDevice ) );
 	cudaSafeCall( cudaMemcpy( d_v, v, size, cudaMemcpyHostToDevice ) );
 
-	step_kernel<<<(BLKDIM + n - 1)/BLKDIM, BLKDIM>>>(d_x, d_v, d_xnext, d_vnext, n);
+	KERNEL_LAUNCH(step_kernel, (BLKDIM + n - 1)/BLKDIM, BLKDIM, d_x, d_v, d_xnext, d_vnext, n);
 	cudaCheckError();
 
 	cudaSafeCall( cudaMemcpy( xnext, d_xnext, size, cudaMemcpyDeviceToHost ) );
 	cudaSafeCall( cudaMemcpy( vnext, d_vnext, size, cudaMemcpyDeviceToHost ) );
+
+	cudaFree(d_x);
+	cudaFree(d_v);
+	cudaFree(d_xnext);
+	cudaFree(d_vnext);
 }
 
 /**
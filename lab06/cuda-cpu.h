@@ -0,0 +1,474 @@
+/****************************************************************************
+ *
+ * cuda-cpu.h - Run simple CUDA programs on the CPU with OpenMP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * --------------------------------------------------------------------------
+ *
+ * This header file allows the CUDA programs of lab06 and lab07 to be
+ * compiled either with nvcc, or with a C++ compiler as multithreaded
+ * CPU programs, from the same source code:
+ *
+ *      nvcc cuda-dot.cu -o cuda-dot
+ *      g++ -x c++ -fopenmp -O2 cuda-dot.cu -o cuda-dot
+ *
+ * The only change required to a CUDA program is that kernels must be
+ * launched with one of the following macros, since the <<< >>>
+ * syntax is not valid C++:
+ *
+ *      KERNEL_LAUNCH(kernel, grid, block, args...)
+ *      KERNEL_LAUNCH_SYNC(kernel, grid, block, args...)
+ *
+ * With nvcc, both expand to kernel<<<grid, block>>>(args...) and this
+ * header does nothing else. Otherwise, the CUDA keywords, built-in
+ * variables (threadIdx, blockIdx, blockDim, gridDim) and the memory
+ * management functions used in the labs are emulated; "device"
+ * memory is host memory, so that cudaMemcpy() is a plain memcpy().
+ *
+ * KERNEL_LAUNCH() is for kernels that do NOT use __syncthreads() or
+ * __shared__ memory: their CUDA threads are independent, so the whole
+ * index space (all threads of all blocks) is partitioned into
+ * contiguous ranges, one for each OpenMP thread. Consecutive CUDA
+ * threads are executed one after the other by the same OpenMP
+ * thread, so that the accesses of a warp to consecutive memory
+ * locations become a sequential scan. This works also for kernels
+ * executed by a single block (e.g., cuda-dot).
+ *
+ * KERNEL_LAUNCH_SYNC() is for kernels that synchronize the threads
+ * of a block: the blocks are distributed among OpenMP threads, and
+ * each block is executed entirely by one OpenMP thread, with its CUDA
+ * threads as user-level contexts (ucontext fibers) with their own
+ * stack. A fiber runs until it calls __syncthreads() or terminates,
+ * then the next fiber of the block is resumed; when all fibers have
+ * reached the barrier, the first one is resumed again. __shared__
+ * variables are thread-local static variables, so that each block
+ * being executed has its own copy. This is slower than
+ * KERNEL_LAUNCH(), since each context switch costs about as much as a
+ * system call; calling __syncthreads() from a kernel launched with
+ * KERNEL_LAUNCH() aborts the program.
+ *
+ * For each kernel, the number of launches, blocks and CUDA threads,
+ * and the total/min/max execution time of a launch are recorded, and
+ * printed to stderr at program exit together with the throughput in
+ * CUDA threads per second. If the environment variable CUDA_CPU_TRACE
+ * is set, a line is also printed after each launch.
+ *
+ * The program must be compiled with -fopenmp.
+ *
+ ****************************************************************************/
+
+#ifndef CUDA_CPU_H
+#define CUDA_CPU_H
+
+#ifdef __CUDACC__
+
+#define KERNEL_LAUNCH(kernel, grid, block, ...) kernel<<<(grid), (block)>>>(__VA_ARGS__)
+#define KERNEL_LAUNCH_SYNC(kernel, grid, block, ...) kernel<<<(grid), (block)>>>(__VA_ARGS__)
+
+#else
+
+#ifndef _OPENMP
+#error "cuda-cpu.h requires OpenMP: compile with -fopenmp"
+#endif
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#define __global__
+#define __device__
+#define __host__
+#define __shared__ static thread_local
+#define __syncthreads() cuda_cpu_syncthreads()
+
+/* Maximum number of threads of a block, as on current NVidia GPUs */
+#define CUDA_CPU_MAX_BLOCK 1024
+/* Stack size of each CUDA thread of a KERNEL_LAUNCH_SYNC() kernel */
+#define CUDA_CPU_STACK (64*1024)
+/* Maximum number of distinct kernels whose counters are recorded */
+#define CUDA_CPU_MAX_KERNELS 64
+
+struct uint3 {
+    unsigned int x, y, z;
+};
+
+struct dim3 {
+    unsigned int x, y, z;
+    dim3( unsigned int x_ = 1, unsigned int y_ = 1, unsigned int z_ = 1 ) : x(x_), y(y_), z(z_) { }
+};
+
+/* Built-in variables; each OpenMP thread has its own copy */
+static thread_local uint3 threadIdx, blockIdx, blockDim, gridDim;
+/* Nonzero iff the current kernel has been launched with
+   KERNEL_LAUNCH_SYNC() */
+static thread_local int cuda_cpu_sync;
+
+typedef enum {
+    cudaSuccess = 0,
+    cudaErrorInvalidValue = 1,
+    cudaErrorMemoryAllocation = 2,
+    cudaErrorInvalidConfiguration = 9
+} cudaError_t;
+typedef cudaError_t cudaError;
+
+typedef enum {
+    cudaMemcpyHostToHost = 0,
+    cudaMemcpyHostToDevice = 1,
+    cudaMemcpyDeviceToHost = 2,
+    cudaMemcpyDeviceToDevice = 3,
+    cudaMemcpyDefault = 4
+} cudaMemcpyKind;
+
+static cudaError_t cuda_cpu_last_error = cudaSuccess;
+
+const char *cudaGetErrorString( cudaError_t err )
+{
+    switch (err) {
+    case cudaSuccess: return "no error";
+    case cudaErrorInvalidValue: return "invalid argument";
+    case cudaErrorMemoryAllocation: return "out of memory";
+    case cudaErrorInvalidConfiguration: return "invalid configuration argument";
+    default: return "unknown error";
+    }
+}
+
+cudaError_t cudaGetLastError( void )
+{
+    const cudaError_t err = cuda_cpu_last_error;
+    cuda_cpu_last_error = cudaSuccess;
+    return err;
+}
+
+/* Kernels are executed synchronously */
+cudaError_t cudaDeviceSynchronize( void )
+{
+    return cudaSuccess;
+}
+
+cudaError_t cudaSetDevice( int dev )
+{
+    return (0 == dev ? cudaSuccess : cudaErrorInvalidValue);
+}
+
+/******************************************************************************
+ * Counters
+ ******************************************************************************/
+
+typedef struct {
+    const char *name;
+    long launches;
+    double blocks, threads; /* total over all launches */
+    double tot_time, min_time, max_time;
+} cuda_cpu_counters_t;
+
+static cuda_cpu_counters_t cuda_cpu_kernels[CUDA_CPU_MAX_KERNELS];
+static int cuda_cpu_nkernels = 0;
+static long cuda_cpu_memcpy_calls = 0;
+static double cuda_cpu_memcpy_bytes[4] = {0.0, 0.0, 0.0, 0.0}; /* indexed by cudaMemcpyKind */
+
+void cuda_cpu_report( void )
+{
+    if (0 == cuda_cpu_nkernels) {
+        return;
+    }
+    fprintf(stderr, "\n=== Kernel launches on the CPU (%d OpenMP threads) ===\n", omp_get_max_threads());
+    fprintf(stderr, "%-24s %9s %12s %14s %12s %12s %12s %12s\n",
+            "kernel", "launches", "blocks", "threads", "total (s)", "min (s)", "max (s)", "Mthreads/s");
+    for (int k=0; k<cuda_cpu_nkernels; k++) {
+        const cuda_cpu_counters_t *c = cuda_cpu_kernels + k;
+        fprintf(stderr, "%-24s %9ld %12.0f %14.0f %12.6f %12.6f %12.6f %12.1f\n",
+                c->name, c->launches, c->blocks, c->threads,
+                c->tot_time, c->min_time, c->max_time,
+                (c->tot_time > 0.0 ? 1e-6 * c->threads / c->tot_time : 0.0));
+    }
+    fprintf(stderr, "cudaMemcpy(): %ld calls, %.1f MB host to device, %.1f MB device to host\n",
+            cuda_cpu_memcpy_calls,
+            1e-6 * cuda_cpu_memcpy_bytes[cudaMemcpyHostToDevice],
+            1e-6 * cuda_cpu_memcpy_bytes[cudaMemcpyDeviceToHost]);
+}
+
+/* Return the counters of kernel `name`, creating them if necessary */
+cuda_cpu_counters_t *cuda_cpu_counters( const char *name )
+{
+    for (int k=0; k<cuda_cpu_nkernels; k++) {
+        if (0 == strcmp(cuda_cpu_kernels[k].name, name)) {
+            return cuda_cpu_kernels + k;
+        }
+    }
+    if (cuda_cpu_nkernels == CUDA_CPU_MAX_KERNELS) {
+        return NULL;
+    }
+    if (0 == cuda_cpu_nkernels) {
+        atexit(cuda_cpu_report);
+    }
+    cuda_cpu_counters_t *c = cuda_cpu_kernels + cuda_cpu_nkernels++;
+    c->name = name;
+    c->launches = 0;
+    c->blocks = c->threads = 0.0;
+    c->tot_time = c->max_time = 0.0;
+    c->min_time = 1e30;
+    return c;
+}
+
+/******************************************************************************
+ * Memory management
+ ******************************************************************************/
+
+cudaError_t cudaMalloc( void **ptr, size_t size )
+{
+    /* CUDA guarantees at least 256-byte alignment */
+    if (0 != posix_memalign(ptr, 256, (size > 0 ? size : 1))) {
+        *ptr = NULL;
+        return (cuda_cpu_last_error = cudaErrorMemoryAllocation);
+    }
+    return cudaSuccess;
+}
+
+cudaError_t cudaFree( void *ptr )
+{
+    free(ptr);
+    return cudaSuccess;
+}
+
+cudaError_t cudaMemcpy( void *dst, const void *src, size_t count, cudaMemcpyKind kind )
+{
+    if (kind < cudaMemcpyHostToHost || kind > cudaMemcpyDefault) {
+        return (cuda_cpu_last_error = cudaErrorInvalidValue);
+    }
+    memcpy(dst, src, count);
+    cuda_cpu_memcpy_calls++;
+    cuda_cpu_memcpy_bytes[kind] += count;
+    return cudaSuccess;
+}
+
+cudaError_t cudaMemset( void *ptr, int value, size_t count )
+{
+    memset(ptr, value, count);
+    return cudaSuccess;
+}
+
+/******************************************************************************
+ * Error checking (same interface of hpc.h)
+ ******************************************************************************/
+
+#define cudaSafeCall( err ) cuda_cpu_safe_call( err, __FILE__, __LINE__ )
+#define cudaCheckError()    cuda_cpu_check_error( __FILE__, __LINE__ )
+
+void cuda_cpu_safe_call( cudaError_t err, const char *file, const int line )
+{
+    if ( cudaSuccess != err ) {
+        fprintf( stderr, "cudaSafeCall() failed at %s:%i : %s\n",
+                 file, line, cudaGetErrorString( err ) );
+        abort();
+    }
+}
+
+void cuda_cpu_check_error( const char *file, const int line )
+{
+    const cudaError_t err = cudaGetLastError();
+    if ( cudaSuccess != err ) {
+        fprintf( stderr, "cudaCheckError() failed at %s:%i : %s\n",
+                 file, line, cudaGetErrorString( err ) );
+        abort();
+    }
+}
+
+/******************************************************************************
+ * Kernel execution
+ ******************************************************************************/
+
+/* Advance `idx` to the next index of the space `dim`, in x, y, z
+   order; return nonzero on wrap-around */
+static inline int cuda_cpu_next( uint3 &idx, const dim3 &dim )
+{
+    if (++idx.x < dim.x) return 0;
+    idx.x = 0;
+    if (++idx.y < dim.y) return 0;
+    idx.y = 0;
+    if (++idx.z < dim.z) return 0;
+    idx.z = 0;
+    return 1;
+}
+
+/* Return the `i`-th index of the space `dim` */
+static inline uint3 cuda_cpu_unflatten( long i, const dim3 &dim )
+{
+    uint3 idx;
+    idx.x = i % dim.x;
+    idx.y = (i / dim.x) % dim.y;
+    idx.z = i / ((long)dim.x * dim.y);
+    return idx;
+}
+
+static inline uint3 cuda_cpu_uint3( const dim3 &d )
+{
+    uint3 u;
+    u.x = d.x; u.y = d.y; u.z = d.z;
+    return u;
+}
+
+/* Fibers of the block being executed by the calling OpenMP thread */
+typedef struct {
+    ucontext_t ctx;
+    int done;
+} cuda_cpu_fiber_t;
+
+static thread_local ucontext_t cuda_cpu_sched_ctx;
+static thread_local cuda_cpu_fiber_t *cuda_cpu_fibers, *cuda_cpu_cur_fiber;
+static thread_local char *cuda_cpu_stacks;
+static thread_local long cuda_cpu_nfibers; /* capacity of the arrays above */
+static thread_local void (*cuda_cpu_body)( void *arg );
+static thread_local void *cuda_cpu_body_arg;
+
+void cuda_cpu_syncthreads( void )
+{
+    if (!cuda_cpu_sync) {
+        if (blockDim.x * blockDim.y * blockDim.z == 1) {
+            return;
+        }
+        fprintf(stderr, "FATAL: __syncthreads() called by a kernel launched with KERNEL_LAUNCH(); use KERNEL_LAUNCH_SYNC()\n");
+        abort();
+    }
+    /* yield to the scheduler, that resumes the next fiber */
+    swapcontext(&cuda_cpu_cur_fiber->ctx, &cuda_cpu_sched_ctx);
+}
+
+static void cuda_cpu_fiber_entry( void )
+{
+    cuda_cpu_body(cuda_cpu_body_arg);
+    cuda_cpu_cur_fiber->done = 1;
+    /* returning resumes uc_link, i.e., the scheduler */
+}
+
+/* Execute one block of `nthreads` fibers on the calling OpenMP
+   thread; blockIdx, blockDim and gridDim must already be set */
+void cuda_cpu_run_block( long nthreads, const dim3 &block )
+{
+    if (cuda_cpu_nfibers < nthreads) {
+        free(cuda_cpu_fibers);
+        free(cuda_cpu_stacks);
+        cuda_cpu_fibers = (cuda_cpu_fiber_t*)malloc(nthreads * sizeof(cuda_cpu_fiber_t));
+        cuda_cpu_stacks = (char*)malloc(nthreads * CUDA_CPU_STACK);
+        if (NULL == cuda_cpu_fibers || NULL == cuda_cpu_stacks) {
+            fprintf(stderr, "FATAL: cannot allocate the stacks of %ld CUDA threads\n", nthreads);
+            abort();
+        }
+        cuda_cpu_nfibers = nthreads;
+    }
+    for (long t=0; t<nthreads; t++) {
+        cuda_cpu_fiber_t *f = cuda_cpu_fibers + t;
+        getcontext(&f->ctx);
+        f->ctx.uc_stack.ss_sp = cuda_cpu_stacks + t * CUDA_CPU_STACK;
+        f->ctx.uc_stack.ss_size = CUDA_CPU_STACK;
+        f->ctx.uc_link = &cuda_cpu_sched_ctx;
+        makecontext(&f->ctx, cuda_cpu_fiber_entry, 0);
+        f->done = 0;
+    }
+    /* Each pass resumes every fiber once, i.e., executes the block up
+       to the next barrier */
+    long active = nthreads;
+    while (active > 0) {
+        for (long t=0; t<nthreads; t++) {
+            cuda_cpu_fiber_t *f = cuda_cpu_fibers + t;
+            if (!f->done) {
+                threadIdx = cuda_cpu_unflatten(t, block);
+                cuda_cpu_cur_fiber = f;
+                swapcontext(&cuda_cpu_sched_ctx, &f->ctx);
+                active -= f->done;
+            }
+        }
+    }
+}
+
+/* Call the lambda pointed to by `f` */
+template <typename F>
+void cuda_cpu_call( void *f )
+{
+    (*(F*)f)();
+}
+
+template <typename... Params, typename... A>
+void cuda_cpu_launch( const char *name, int sync, dim3 grid, dim3 block, void (*kernel)(Params...), A&&... args )
+{
+    const long nblocks = (long)grid.x * grid.y * grid.z;
+    const long nthreads = (long)block.x * block.y * block.z;
+    const uint3 ugrid = cuda_cpu_uint3(grid), ublock = cuda_cpu_uint3(block);
+    auto run = [&]() { kernel(args...); };
+
+    if (nblocks <= 0 || nthreads <= 0 || nthreads > CUDA_CPU_MAX_BLOCK) {
+        cuda_cpu_last_error = cudaErrorInvalidConfiguration;
+        return;
+    }
+
+    const double tstart = omp_get_wtime();
+    if (sync) {
+#pragma omp parallel default(none) shared(run, grid, block, ugrid, ublock, nblocks, nthreads)
+        {
+            cuda_cpu_sync = 1;
+            cuda_cpu_body = cuda_cpu_call<decltype(run)>;
+            cuda_cpu_body_arg = (void*)&run;
+            gridDim = ugrid;
+            blockDim = ublock;
+#pragma omp for schedule(static)
+            for (long b=0; b<nblocks; b++) {
+                blockIdx = cuda_cpu_unflatten(b, grid);
+                cuda_cpu_run_block(nthreads, block);
+            }
+            cuda_cpu_sync = 0;
+        }
+    } else {
+#pragma omp parallel default(none) shared(run, grid, block, ugrid, ublock, nblocks, nthreads)
+        {
+            const long total = nblocks * nthreads;
+            const long P = omp_get_num_threads();
+            const long p = omp_get_thread_num();
+            const long lo = total * p / P, hi = total * (p + 1) / P;
+
+            gridDim = ugrid;
+            blockDim = ublock;
+            blockIdx = cuda_cpu_unflatten(lo / nthreads, grid);
+            threadIdx = cuda_cpu_unflatten(lo % nthreads, block);
+            for (long t=lo; t<hi; t++) {
+                run();
+                if (cuda_cpu_next(threadIdx, block)) {
+                    cuda_cpu_next(blockIdx, grid);
+                }
+            }
+        }
+    }
+    const double elapsed = omp_get_wtime() - tstart;
+
+    cuda_cpu_counters_t *c = cuda_cpu_counters(name);
+    if (c != NULL) {
+        c->launches++;
+        c->blocks += nblocks;
+        c->threads += (double)nblocks * nthreads;
+        c->tot_time += elapsed;
+        c->min_time = (elapsed < c->min_time ? elapsed : c->min_time);
+        c->max_time = (elapsed > c->max_time ? elapsed : c->max_time);
+    }
+    if (getenv("CUDA_CPU_TRACE")) {
+        fprintf(stderr, "%s<<<(%u,%u,%u), (%u,%u,%u)>>> %f s\n", name,
+                grid.x, grid.y, grid.z, block.x, block.y, block.z, elapsed);
+    }
+}
+
+#define KERNEL_LAUNCH(kernel, grid, block, ...) cuda_cpu_launch(#kernel, 0, (grid), (block), kernel, __VA_ARGS__)
+#define KERNEL_LAUNCH_SYNC(kernel, grid, block, ...) cuda_cpu_launch(#kernel, 1, (grid), (block), kernel, __VA_ARGS__)
+
+#endif
+
+#endif
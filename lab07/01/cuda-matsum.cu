@@ -48,6 +48,11 @@ To compile:
 
         nvcc cuda-matsum.cu -o cuda-matsum -lm
 
+To compile as a multithreaded CPU program, on a machine without an
+NVidia GPU (see [cuda-cpu.h](cuda-cpu.h)):
+
+        g++ -x c++ -fopenmp -O2 cuda-matsum.cu -o cuda-matsum -lm
+
 To execute:
 
         ./cuda-matsum [N]
@@ -60,9 +65,11 @@ Example:
 
 - [cuda-matsum.cu](cuda-matsum.cu)
 - [hpc.h](hpc.h)
+- [cuda-cpu.h](cuda-cpu.h)
 
 ***/
 #include "../hpc.h"
+#include "../cuda-cpu.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -101,7 +108,7 @@ void matsum( float *p, float *q, float *r, int n )
 		dim3 block(BLKDIM, BLKDIM);
 		dim3 grid((BLKDIM+n - 1)/BLKDIM, (BLKDIM + n - 1)/BLKDIM);
 
-		kernel_matsum<<<grid, block>>>(d_p, d_q, d_r, n);
+		KERNEL_LAUNCH(kernel_matsum, grid, block, d_p, d_q, d_r, n);
 		cudaCheckError();
 
 		cudaSafeCall(cudaMemcpy(r, d_r, size, cudaMemcpyDeviceToHost));
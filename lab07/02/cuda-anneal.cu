@@ -178,6 +178,11 @@ To compile without using shared memory:
 
         nvcc cuda-anneal.cu -o cuda-anneal
 
+To compile as a multithreaded CPU program, on a machine without an
+NVidia GPU (see [cuda-cpu.h](cuda-cpu.h)):
+
+        g++ -x c++ -fopenmp -O2 cuda-anneal.cu -o cuda-anneal
+
 To generate an image after every step:
 
         nvcc -DDUMPALL cuda-anneal.cu -o cuda-anneal
@@ -209,10 +214,12 @@ Example:
 
 - [cuda-anneal.cu](cuda-anneal.cu)
 - [hpc.h](hpc.h)
+- [cuda-cpu.h](cuda-cpu.h)
 - [Animation of the ANNEAL CA on YouTube](https://youtu.be/TSHWSjICCxs)
 
 ***/
 #include "../hpc.h"
+#include "../cuda-cpu.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -335,7 +342,7 @@ void copy_left_right(cell_t *grid, int ext_width, int ext_height)
 
 __global__ void copy_left_right(cell_t *grid, int ext_width, int ext_height)
 {
-    const int i = threadIdx.y + blockIdx.y * blockDim.y;
+    const int i = threadIdx.x + blockIdx.x * blockDim.x;
     const int LEFT = 1;
     const int RIGHT = ext_width - 2;
     const int LEFT_GHOST = LEFT - 1;
@@ -500,13 +507,13 @@ int main( int argc, char* argv[] )
 		cudaSafeCall(cudaMemcpy(d_cur, cur, ext_size, cudaMemcpyHostToDevice));
 
     for (s=0; s<nsteps; s++) {
-        copy_top_bottom<<<copyTBGrid, copyTBBlock>>>(d_cur, ext_width, ext_height);
-        copy_left_right<<<copyLRGrid, copyLRBlock>>>(d_cur, ext_width, ext_height);
+        KERNEL_LAUNCH(copy_top_bottom, copyTBGrid, copyTBBlock, d_cur, ext_width, ext_height);
+        KERNEL_LAUNCH(copy_left_right, copyLRGrid, copyLRBlock, d_cur, ext_width, ext_height);
 #ifdef DUMPALL
 				cudaSafeCall(cudaMemcpy(cur, d_cur, ext_size, cudaMemcpyDeviceToHost));
         write_pbm(cur, ext_width, ext_height, s);
 #endif
-        step<<<stepGrid, stepBlock>>>(d_cur, d_next, ext_width, ext_height);
+        KERNEL_LAUNCH(step, stepGrid, stepBlock, d_cur, d_next, ext_width, ext_height);
         cell_t *tmp = d_cur;
         d_cur = d_next;
         d_next = tmp;
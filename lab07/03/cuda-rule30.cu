@@ -150,6 +150,11 @@ To compile:
 
         nvcc cuda-rule30.cu -o cuda-rule30
 
+To compile as a multithreaded CPU program, on a machine without an
+NVidia GPU (see [cuda-cpu.h](cuda-cpu.h)):
+
+        g++ -x c++ -fopenmp -O2 cuda-rule30.cu -o cuda-rule30
+
 To execute:
 
         ./cuda-rule30 [width [steps]]
@@ -164,9 +169,11 @@ The output is stored to the file `cuda-rule30.pbm`
 
 - [cuda-rule30.cu](cuda-rule30.cu)
 - [hpc.h](hpc.h)
+- [cuda-cpu.h](cuda-cpu.h)
 
  ***/
 #include "../hpc.h"
+#include "../cuda-cpu.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -211,14 +218,16 @@ __global__ void step( cell_t *cur, cell_t *next, int ext_n )
 
 		__syncthreads();
 
-    const cell_t left   = buf[lindex-1];
-    const cell_t center = buf[lindex  ];
-    const cell_t right  = buf[lindex+1];
-    next[gindex] =
-        ( left && !center && !right) ||
-        (!left && !center &&  right) ||
-        (!left &&  center && !right) ||
-        (!left &&  center &&  right);
+		if (gindex < ext_n - 1) {
+				const cell_t left   = buf[lindex-1];
+				const cell_t center = buf[lindex  ];
+				const cell_t right  = buf[lindex+1];
+				next[gindex] =
+						( left && !center && !right) ||
+						(!left && !center &&  right) ||
+						(!left &&  center && !right) ||
+						(!left &&  center &&  right);
+		}
 }
 
 /**
@@ -311,10 +320,10 @@ int main( int argc, char* argv[] )
         dump_state(out, cur, ext_width);
 
         /* Fill ghost cells */
-				fill_ghost<<<1, 1>>>(d_cur, ext_width);
+				KERNEL_LAUNCH(fill_ghost, 1, 1, d_cur, ext_width);
 
         /* Compute next state */
-        step<<<(BLKDIM + width - 1)/BLKDIM, BLKDIM>>>(d_cur, d_next, ext_width);
+        KERNEL_LAUNCH_SYNC(step, (BLKDIM + width - 1)/BLKDIM, BLKDIM, d_cur, d_next, ext_width);
 				cudaCheckError();
 
 				cudaSafeCall(cudaMemcpy(cur, d_cur, ext_size, cudaMemcpyDeviceToHost));
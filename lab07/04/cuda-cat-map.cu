@@ -167,6 +167,11 @@ To compile:
 
         nvcc cuda-cat-map.cu -o cuda-cat-map
 
+To compile as a multithreaded CPU program, on a machine without an
+NVidia GPU (see [cuda-cpu.h](cuda-cpu.h)):
+
+        g++ -x c++ -fopenmp -O2 cuda-cat-map.cu -o cuda-cat-map
+
 To execute:
 
         ./cuda-cat-map k < input_file > output_file
@@ -179,11 +184,13 @@ Example:
 
 - [cuda-cat-map.cu](cuda-cat-map.cu)
 - [hpc.h](hpc.h)
+- [cuda-cpu.h](cuda-cpu.h)
 - [cat1368.pgm](cat1368.pgm) (the minimum recurrence time of this image is 36)
 
 ***/
 
 #include "../hpc.h"
+#include "../cuda-cpu.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -309,7 +316,7 @@ __global__ void cat_map_iter(unsigned char *cur, unsigned char *next, int N, int
 		const int x = threadIdx.x + blockIdx.x * blockDim.x;
 		const int y = threadIdx.y + blockIdx.y * blockDim.y;
 
-		int xcur = x, ycur = y, xnext, ynext;
+		int xcur = x, ycur = y, xnext = x, ynext = y;
 
 		if (x < N && y < N) {
 				while(k--) {
@@ -349,7 +356,7 @@ void cat_map( PGM_image* img, int k )
 		dim3 block(BLKDIM, BLKDIM);
 		dim3 grid((N+BLKDIM - 1)/BLKDIM, (N+BLKDIM - 1)/BLKDIM);
 
-		cat_map_iter<<<grid, block>>>(d_cur, d_next, N, k);
+		KERNEL_LAUNCH(cat_map_iter, grid, block, d_cur, d_next, N, k);
 		cudaCheckError();
 
 		cudaSafeCall(cudaMemcpy(img->bmap, d_next, size, cudaMemcpyDeviceToHost));
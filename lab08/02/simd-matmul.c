@@ -21,7 +21,7 @@
 /***
 % HPC - Prodotto matrice-matrice SIMD
 % Moreno Marzolla <moreno.marzolla@unibo.it>
-% Ultimo aggiornamento: 2021-05-15
+% Ultimo aggiornamento: 2026-10-18
 
 Il file [simd-matmul.c](simd-matmul.c) contiene la versione seriale
 del prodotto matrice-matrice $r=p \times q$, sia nella versione
@@ -68,17 +68,61 @@ Intel fino ad AVX2, e quindi dispone di registri SIMD di ampiezza 256
 bit = 32 Byte. Si provi a modificare la propria implementazione per
 sfruttare un tipo vettoriale `v4d` contenente quattro valori `double`.
 
+## Prodotto di molte matrici piccole
+
+Quando occorre moltiplicare un gran numero di coppie di matrici
+piccole (da $4 \times 4$ a $64 \times 64$), chiamare
+`simd_matmul_tr()` per ciascuna coppia è inefficiente: ogni chiamata
+alloca e traspone una matrice, e i prodotti scalari sono troppo corti
+per sfruttare bene i vettori SIMD (la somma finale delle componenti
+di `vv` pesa quanto il ciclo).
+
+La funzione `simd_matmul_batch()` calcola $r_b = p_b \times q_b$ per
+$b = 0, \ldots, \mathit{nbatch}-1$ usando una disposizione in
+memoria _interleaved_: le matrici sono raggruppate a `BLEN` a `BLEN`
+(`BLEN` è il numero di `double` di un vettore `v4d`, cioè 4), e
+l'elemento $(i, j)$ della matrice $b$ si trova in posizione
+
+        ((b / BLEN) * m * m + i * m + j) * BLEN + b % BLEN
+
+Quindi gli elementi $(i, j)$ delle matrici di un gruppo formano un
+vettore `v4d`, e ciascuna lane SIMD calcola il prodotto di una
+matrice diversa con le stesse operazioni del prodotto scalare
+"scalare": non servono trasposizioni né somme orizzontali, e il
+risultato non dipende da $m$ essere multiplo della lunghezza dei
+vettori. Le funzioni `batch_pack()` e `batch_unpack()` convertono da
+e verso la disposizione per righe; i dati sono allocati per un numero
+di matrici multiplo di `BLEN`.
+
+Il corpo del prodotto è la funzione _inline_ `batch_kernel()`; per le
+dimensioni più comuni ($m = 4, 8, 16$) ne vengono generate versioni
+in cui $m$ è una costante nota al compilatore, che può quindi
+srotolare i cicli e tenere le righe del risultato nei registri; per
+matrici più grandi lo srotolamento completo non porta vantaggi (con
+$m = 32$ risulta anzi più lento), e si usa la versione generica. I
+gruppi sono suddivisi tra i thread OpenMP.
+
+Con l'opzione `-b` il programma moltiplica `nbatch` coppie di matrici
+$m \times m$ (per default, circa $2^{22}$ elementi per matrice in
+totale), e confronta il throughput (matrici/s e Gflops) di
+`simd_matmul_batch()` con quello di un ciclo OpenMP che chiama
+`simd_matmul_tr()` su ogni coppia; i risultati vengono anche
+confrontati tra loro. I valori degli elementi sono multipli di $1/8$,
+per cui i due risultati devono coincidere esattamente.
+
 Compilare con:
 
-        gcc -march=native -O2 -std=c99 -Wall -Wpedantic -D_XOPEN_SOURCE=600 simd-matmul.c -o simd-matmul
+        gcc -march=native -O2 -std=c99 -Wall -Wpedantic -D_XOPEN_SOURCE=600 -fopenmp simd-matmul.c -o simd-matmul
 
 Eseguire con
 
         ./simd-matmul [matrix size]
+        ./simd-matmul -b m [nbatch]
 
 Esempio:
 
         ./simd-matmul 1024
+        OMP_NUM_THREADS=4 ./simd-matmul -b 8 1000000
 
 ## File
 
@@ -88,7 +132,6 @@ Esempio:
 ***/
 
 /* The following #define is required by posix_memalign() */
-#include <malloc/_malloc.h>
 #define _XOPEN_SOURCE 600
 
 #include "hpc.h"
@@ -96,10 +139,16 @@ Esempio:
 #include <stdlib.h>
 #include <assert.h>  /* for assert() */
 #include <strings.h> /* for bzero() */
+#include <string.h>  /* for strcmp() */
 
 typedef double v2d __attribute__((vector_size(16)));
 #define VLEN (sizeof(v2d)/sizeof(double))
 
+/* Vectors used by the batched multiply: lane l of a vector belongs
+   to the l-th matrix of a group of BLEN matrices */
+typedef double v4d __attribute__((vector_size(32)));
+#define BLEN (sizeof(v4d)/sizeof(double))
+
 /* Fills n x n square matrix m */
 void fill( double* m, int n )
 {
@@ -190,6 +239,168 @@ void simd_matmul_tr( const double *p, const double* q, double *r, int n)
       r[i*n + j] = vv[0] + vv[1];
     }
   }
+  free(qT);
+}
+
+/* Number of groups of BLEN matrices needed to hold nbatch matrices */
+long batch_groups( long nbatch )
+{
+    return (nbatch + BLEN - 1) / BLEN;
+}
+
+/* Allocate an interleaved batch of nbatch m x m matrices */
+double *batch_alloc( int m, long nbatch )
+{
+    double *a;
+    const int ret = posix_memalign((void**)&a, 64, batch_groups(nbatch) * BLEN * m * m * sizeof(*a));
+    assert(0 == ret);
+    return a;
+}
+
+/* Copy the nbatch m x m matrices stored by rows one after the other
+   in a[] into the interleaved batch A[]; the unused matrices of the
+   last group are set to zero */
+void batch_pack( const double *a, double *A, int m, long nbatch )
+{
+    const long ngroups = batch_groups(nbatch);
+    const int mm = m*m;
+#pragma omp parallel for schedule(static)
+    for (long g=0; g<ngroups; g++) {
+        for (int l=0; l<(int)BLEN; l++) {
+            const long b = g*BLEN + l;
+            for (int e=0; e<mm; e++) {
+                A[(g*mm + e)*BLEN + l] = (b < nbatch ? a[b*mm + e] : 0.0);
+            }
+        }
+    }
+}
+
+/* Inverse of batch_pack() */
+void batch_unpack( const double *A, double *a, int m, long nbatch )
+{
+    const int mm = m*m;
+#pragma omp parallel for schedule(static)
+    for (long b=0; b<nbatch; b++) {
+        const long g = b / BLEN, l = b % BLEN;
+        for (int e=0; e<mm; e++) {
+            a[b*mm + e] = A[(g*mm + e)*BLEN + l];
+        }
+    }
+}
+
+/* Compute the BLEN products r = p * q of a group of m x m matrices
+   in interleaved layout. When inlined with a constant m, the loops
+   can be fully unrolled. */
+static inline __attribute__((always_inline))
+void batch_kernel( const v4d *restrict p, const v4d *restrict q, v4d *restrict r, int m )
+{
+    for (int i=0; i<m; i++) {
+        v4d *ri = r + i*m;
+        for (int j=0; j<m; j++) {
+            ri[j] = (v4d){0.0, 0.0, 0.0, 0.0};
+        }
+        for (int k=0; k<m; k++) {
+            const v4d a = p[i*m + k];
+            const v4d *qk = q + k*m;
+            for (int j=0; j<m; j++) {
+                ri[j] += a * qk[j];
+            }
+        }
+    }
+}
+
+/* Apply the kernel for size M (a constant, or the variable m) to all
+   the groups of the batch */
+#define BATCH_LOOP(M)                                                   \
+    do {                                                                \
+        _Pragma("omp parallel for schedule(static)")                    \
+        for (long g=0; g<ngroups; g++) {                                \
+            const long off = g * (M) * (M);                             \
+            batch_kernel(vp + off, vq + off, vr + off, (M));            \
+        }                                                               \
+    } while (0)
+
+/* Compute r_b = p_b * q_b for b = 0, ..., nbatch-1, where p, q, r are
+   interleaved batches of m x m matrices allocated with batch_alloc() */
+void simd_matmul_batch( const double *p, const double *q, double *r, int m, long nbatch )
+{
+    const v4d *vp = (const v4d*)p;
+    const v4d *vq = (const v4d*)q;
+    v4d *vr = (v4d*)r;
+    const long ngroups = batch_groups(nbatch);
+
+    switch (m) {
+    case 4: BATCH_LOOP(4); break;
+    case 8: BATCH_LOOP(8); break;
+    case 16: BATCH_LOOP(16); break;
+    default: BATCH_LOOP(m);
+    }
+}
+
+/* Fill the nbatch m x m matrices stored by rows in a[]; the values
+   are multiples of 1/8 in [-1, 1], so that all products and sums
+   are exact */
+void batch_fill( double *a, int m, long nbatch, int seed )
+{
+    const int mm = m*m;
+#pragma omp parallel for schedule(static)
+    for (long b=0; b<nbatch; b++) {
+        for (int e=0; e<mm; e++) {
+            a[b*mm + e] = ((b*7 + e*3 + seed) % 17) / 8.0 - 1.0;
+        }
+    }
+}
+
+/* Compare the batched multiply of nbatch m x m matrices with a loop
+   over simd_matmul_tr(); returns nonzero iff the results agree */
+int batch_benchmark( int m, long nbatch )
+{
+    const int mm = m*m;
+    const size_t size = nbatch * mm * sizeof(double);
+    const double flops = 2.0 * m * m * m * nbatch;
+    double *p, *q, *r, *r2, *P, *Q, *R;
+    double tstart, tloop, tbatch;
+    int ret;
+
+    ret = posix_memalign((void**)&p, __BIGGEST_ALIGNMENT__, size); assert(0 == ret);
+    ret = posix_memalign((void**)&q, __BIGGEST_ALIGNMENT__, size); assert(0 == ret);
+    ret = posix_memalign((void**)&r, __BIGGEST_ALIGNMENT__, size); assert(0 == ret);
+    ret = posix_memalign((void**)&r2, __BIGGEST_ALIGNMENT__, size); assert(0 == ret);
+    P = batch_alloc(m, nbatch);
+    Q = batch_alloc(m, nbatch);
+    R = batch_alloc(m, nbatch);
+
+    batch_fill(p, m, nbatch, 0);
+    batch_fill(q, m, nbatch, 5);
+    batch_pack(p, P, m, nbatch);
+    batch_pack(q, Q, m, nbatch);
+    /* touch the results, so that page faults are not timed */
+    bzero(r, size);
+    bzero(R, batch_groups(nbatch) * BLEN * mm * sizeof(*R));
+    printf("\nBatch of %ld matrices of size %d x %d\n\n", nbatch, m, m);
+
+    tstart = hpc_gettime();
+#pragma omp parallel for schedule(static)
+    for (long b=0; b<nbatch; b++) {
+        simd_matmul_tr(p + b*mm, q + b*mm, r + b*mm, m);
+    }
+    tloop = hpc_gettime() - tstart;
+    printf("Loop of simd_matmul_tr\tExec time = %f, %.0f matrices/s, %.2f Gflops\n",
+           tloop, nbatch / tloop, 1e-9 * flops / tloop);
+
+    tstart = hpc_gettime();
+    simd_matmul_batch(P, Q, R, m, nbatch);
+    tbatch = hpc_gettime() - tstart;
+    printf("simd_matmul_batch\tExec time = %f, %.0f matrices/s, %.2f Gflops (speedup %.2fx)\n",
+           tbatch, nbatch / tbatch, 1e-9 * flops / tbatch, tloop / tbatch);
+
+    batch_unpack(R, r2, m, nbatch);
+    const int ok = (0 == memcmp(r, r2, size));
+    printf("Check: %s\n", ok ? "OK" : "FAILED");
+
+    free(p); free(q); free(r); free(r2);
+    free(P); free(Q); free(R);
+    return ok;
 }
 
 int main( int argc, char* argv[] )
@@ -199,8 +410,22 @@ int main( int argc, char* argv[] )
     double tstart, elapsed, tserial;
     int ret;
 
+    if ( argc > 1 && 0 == strcmp(argv[1], "-b") ) {
+        if ( argc < 3 || argc > 4 ) {
+            fprintf(stderr, "Usage: %s -b m [nbatch]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        const int m = atoi(argv[2]);
+        const long nbatch = (argc > 3 ? atol(argv[3]) : (1L << 22) / ((long)m*m) + 1);
+        if ( m <= 0 || 0 != m % VLEN || nbatch <= 0 ) {
+            fprintf(stderr, "FATAL: the matrix size must be a positive multiple of %d\n", (int)VLEN);
+            return EXIT_FAILURE;
+        }
+        return (batch_benchmark(m, nbatch) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     if ( argc > 2 ) {
-        fprintf(stderr, "Usage: %s [n]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [n]\n       %s -b m [nbatch]\n", argv[0], argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -0,0 +1,302 @@
+/****************************************************************************
+ *
+ * simd-kernels.h - Memory-bound elementwise kernels for the CPU
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * --------------------------------------------------------------------------
+ *
+ * CPU counterparts of the kernels of lab06/02 (cuda-reverse.cu) and
+ * lab07/01 (cuda-matsum.cu), plus a few other elementwise operations
+ * on arrays of floats:
+ *
+ *      k_copy(b, a, n)              b[i] = a[i]
+ *      k_scale(b, a, s, n)          b[i] = s * a[i]
+ *      k_add(c, a, b, n)            c[i] = a[i] + b[i]
+ *      k_axpy(y, s, x, n)           y[i] = s * x[i] + y[i]
+ *      k_reverse(b, a, n)           b[i] = a[n-1-i]
+ *      k_transpose_add(C, A, B, n)  C = A + B^T  (n x n matrices)
+ *
+ * These operations perform one or two arithmetic operations per
+ * element, so their speed is limited by the memory bandwidth. Three
+ * techniques are used to get as close as possible to it:
+ *
+ * - Non-temporal stores: the destination is written with streaming
+ *   stores that bypass the caches. A regular store first reads the
+ *   destination cache line from memory ("read for ownership"); for a
+ *   destination that is entirely overwritten this is wasted
+ *   bandwidth, and it also evicts useful data from the caches.
+ *   Streaming stores are used on x86 with SSE/AVX; elsewhere, plain
+ *   vector stores are used.
+ *
+ * - Static scheduling: each thread always processes the same block
+ *   of indices, computed by k_range(), whose boundaries are aligned
+ *   to 64 bytes so that streaming stores never split a cache line
+ *   between two threads.
+ *
+ * - NUMA first touch: on a NUMA machine, a memory page is placed on
+ *   the node of the thread that first writes it. k_first_touch()
+ *   initializes an array with the same partition used by the
+ *   kernels, so that each thread later reads and writes memory that
+ *   is local to it. Arrays must be allocated with k_alloc() (64-byte
+ *   aligned) and initialized with k_first_touch() before use.
+ *
+ * Compile with -fopenmp -O2 -march=native; -D_XOPEN_SOURCE=600 (or
+ * the equivalent #define) is needed for posix_memalign().
+ *
+ ****************************************************************************/
+
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <omp.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+typedef float vf __attribute__((vector_size(32)));
+typedef int vi __attribute__((vector_size(32)));
+#define VREV ((vi){7, 6, 5, 4, 3, 2, 1, 0})
+#define K_STREAM(p, v) _mm256_stream_ps((p), (__m256)(v))
+#define K_FENCE() _mm_sfence()
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+typedef float vf __attribute__((vector_size(16)));
+typedef int vi __attribute__((vector_size(16)));
+#define VREV ((vi){3, 2, 1, 0})
+#define K_STREAM(p, v) _mm_stream_ps((p), (__m128)(v))
+#define K_FENCE() _mm_sfence()
+#else
+typedef float vf __attribute__((vector_size(16)));
+typedef int vi __attribute__((vector_size(16)));
+#define VREV ((vi){3, 2, 1, 0})
+#define K_STREAM(p, v) (*(vf*)(p) = (v))
+#define K_FENCE() ((void)0)
+#endif
+
+/* Same as vf, but can be used to load from unaligned addresses */
+typedef float vfu __attribute__((vector_size(sizeof(vf)), aligned(4)));
+
+#define VLEN ((long)(sizeof(vf)/sizeof(float)))
+
+/* Number of floats in a 64-byte cache line */
+#define K_LINE 16
+
+/**
+ * Allocate an array of `n` floats aligned to a cache line; the
+ * memory must be released with free().
+ */
+float *k_alloc( long n )
+{
+    float *p;
+    const int ret = posix_memalign((void**)&p, 64, (n > 0 ? n : 1) * sizeof(float));
+    assert(0 == ret);
+    return p;
+}
+
+/**
+ * Compute the block [*lo, *hi) of indices 0 .. n-1 assigned to the
+ * calling thread; all boundaries except n are multiples of K_LINE.
+ */
+void k_range( long n, long *lo, long *hi )
+{
+    const int P = omp_get_num_threads();
+    const int p = omp_get_thread_num();
+    const long nlines = (n + K_LINE - 1) / K_LINE;
+    const long l0 = nlines * p / P, l1 = nlines * (p + 1) / P;
+    *lo = (l0 * K_LINE < n ? l0 * K_LINE : n);
+    *hi = (l1 * K_LINE < n ? l1 * K_LINE : n);
+}
+
+/* Store `v` into dst[i .. i+VLEN-1]; dst+i must be aligned */
+#define K_STORE(dst, i, v) K_STREAM((dst) + (i), (v))
+
+/*
+ * Apply an elementwise operation to the indices [lo, hi): SEXPR(i)
+ * computes element i with scalar code, VEXPR(i) computes elements i
+ * .. i+VLEN-1 as a vector. The destination `dst` is assumed to be
+ * aligned to 64 bytes, and lo to be a multiple of K_LINE.
+ */
+#define K_LOOP(dst, lo, hi, i, SEXPR, VEXPR)                    \
+    do {                                                        \
+        long i = (lo);                                          \
+        for (; i + VLEN <= (hi); i += VLEN) {                   \
+            K_STORE(dst, i, VEXPR);                             \
+        }                                                       \
+        for (; i < (hi); i++) {                                 \
+            (dst)[i] = SEXPR;                                   \
+        }                                                       \
+        K_FENCE();                                              \
+    } while (0)
+
+#define VLOAD(p) (*(const vfu*)(p))
+
+/**
+ * Initialize the `n` elements of `a` to `v` using the same partition
+ * of the kernels below (see the comment at the top of this file).
+ */
+void k_first_touch( float *a, float v, long n )
+{
+    const vf vv = (vf){0} + v;
+#pragma omp parallel default(none) shared(a, v, vv, n)
+    {
+        long lo, hi;
+        k_range(n, &lo, &hi);
+        K_LOOP(a, lo, hi, i, v, vv);
+    }
+}
+
+void k_copy( float *b, const float *a, long n )
+{
+#pragma omp parallel default(none) shared(a, b, n)
+    {
+        long lo, hi;
+        k_range(n, &lo, &hi);
+        K_LOOP(b, lo, hi, i, a[i], VLOAD(a + i));
+    }
+}
+
+void k_scale( float *b, const float *a, float s, long n )
+{
+#pragma omp parallel default(none) shared(a, b, s, n)
+    {
+        long lo, hi;
+        k_range(n, &lo, &hi);
+        K_LOOP(b, lo, hi, i, s * a[i], s * VLOAD(a + i));
+    }
+}
+
+void k_add( float *c, const float *a, const float *b, long n )
+{
+#pragma omp parallel default(none) shared(a, b, c, n)
+    {
+        long lo, hi;
+        k_range(n, &lo, &hi);
+        K_LOOP(c, lo, hi, i, a[i] + b[i], VLOAD(a + i) + VLOAD(b + i));
+    }
+}
+
+void k_axpy( float *y, float s, const float *x, long n )
+{
+#pragma omp parallel default(none) shared(x, y, s, n)
+    {
+        long lo, hi;
+        k_range(n, &lo, &hi);
+        K_LOOP(y, lo, hi, i, s * x[i] + y[i], s * VLOAD(x + i) + VLOAD(y + i));
+    }
+}
+
+/**
+ * b[i] = a[n-1-i]. The vector version loads VLEN elements ending at
+ * a[n-1-i] and reverses their order with a shuffle.
+ */
+void k_reverse( float *b, const float *a, long n )
+{
+#pragma omp parallel default(none) shared(a, b, n)
+    {
+        long lo, hi;
+        k_range(n, &lo, &hi);
+        K_LOOP(b, lo, hi, i, a[n - 1 - i],
+               __builtin_shuffle(VLOAD(a + n - i - VLEN), VREV));
+    }
+}
+
+/* Side of the square tiles of k_transpose_add(); a multiple of
+   K_LINE */
+#ifndef K_TILE
+#define K_TILE 64
+#endif
+
+/* Number of rows of B that k_transpose_add() prefetches in advance */
+#ifndef K_PREFETCH
+#define K_PREFETCH 8
+#endif
+
+/**
+ * C = A + B^T, where A, B, C are n x n matrices stored by rows. Each
+ * thread computes the block of rows of C given by k_range(n, ...),
+ * whose boundaries are multiples of K_LINE rows; this is the same
+ * partition (up to K_LINE rows) that k_first_touch() uses for the n*n
+ * elements of C and A.
+ *
+ * Reading B by columns would touch a different cache line, and a
+ * different memory page, for each element. Instead, the rows of C
+ * are computed in square tiles of K_TILE x K_TILE elements: the
+ * corresponding tile of B is first copied, transposed, into a
+ * private buffer that stays in L1, then the tile of C is computed
+ * from the rows of A and of the buffer, and written with streaming
+ * stores. Every access to A, B and C then covers K_TILE consecutive
+ * elements of a row, i.e., K_TILE / K_LINE full cache lines.
+ *
+ * These short pieces of rows defeat the hardware prefetcher, which
+ * follows a limited number of sequential streams; therefore, the rows
+ * of B needed K_PREFETCH rows later, and the pieces of the rows of A
+ * needed by the next tile, are prefetched in software. The rows of
+ * the buffer are padded by one cache line, otherwise with K_TILE a
+ * power of two they would all map to the same cache sets.
+ */
+void k_transpose_add( float *C, const float *A, const float *B, long n )
+{
+#pragma omp parallel default(none) shared(A, B, C, n)
+    {
+        const long ld = K_TILE + K_LINE; /* row stride of the buffer */
+        long lo, hi;
+        k_range(n, &lo, &hi);
+        float *bt = k_alloc(K_TILE * ld);
+        /* streaming stores need aligned rows, i.e., n must be a
+           multiple of VLEN */
+        const int vec = (((uintptr_t)C % sizeof(vf)) == 0 && n % VLEN == 0);
+
+        for (long ii = lo; ii < hi; ii += K_TILE) {
+            const long ih = (ii + K_TILE < hi ? ii + K_TILE : hi);
+            for (long jj = 0; jj < n; jj += K_TILE) {
+                const long jh = (jj + K_TILE < n ? jj + K_TILE : n);
+                /* bt[i-ii][j-jj] = B[j][i] */
+                for (long j = jj; j < jh; j++) {
+                    const float *b = B + j*n;
+                    if (j + K_PREFETCH < n) {
+                        for (long i = ii; i < ih; i += K_LINE) {
+                            __builtin_prefetch(b + K_PREFETCH*n + i, 0, 1);
+                        }
+                    }
+                    for (long i = ii; i < ih; i++) {
+                        bt[(i - ii)*ld + (j - jj)] = b[i];
+                    }
+                }
+                for (long i = ii; i < ih; i++) {
+                    float *c = C + i*n;
+                    const float *a = A + i*n;
+                    const float *t = bt + (i - ii)*ld;
+                    for (long j = jh; j < jh + K_TILE && j < n; j += K_LINE) {
+                        __builtin_prefetch(a + j, 0, 1);
+                    }
+                    long j = jj;
+                    if (vec) {
+                        for (; j + VLEN <= jh; j += VLEN) {
+                            K_STORE(c, j, VLOAD(a + j) + VLOAD(t + j - jj));
+                        }
+                    }
+                    for (; j < jh; j++) {
+                        c[j] = a[j] + t[j - jj];
+                    }
+                }
+            }
+        }
+        K_FENCE();
+        free(bt);
+    }
+}
+
+#endif
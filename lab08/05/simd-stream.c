@@ -0,0 +1,192 @@
+/****************************************************************************
+ *
+ * simd-stream.c - STREAM-like bandwidth benchmark of simd-kernels.h
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ****************************************************************************/
+
+/***
+% HPC - Memory bandwidth of elementwise kernels
+
+The programs of lab06 and lab07 use the GPU for operations such as
+the sum of two matrices or the reversal of an array. These operations
+require only one or two arithmetic operations for each element that
+is read or written, so their speed is limited by the memory
+bandwidth; on a machine without a GPU, the goal is to run them as
+close as possible to the bandwidth of the main memory.
+
+[simd-kernels.h](simd-kernels.h) contains CPU implementations of some
+of these operations, that combine SIMD instructions, non-temporal
+(streaming) stores, static partitioning among OpenMP threads, and
+NUMA-aware initialization (see the comments in the header file).
+
+This program measures, in the style of the
+[STREAM](https://www.cs.virginia.edu/stream/) benchmark, the memory
+bandwidth achieved by each kernel on arrays of $n$ floats (default
+$n = 2^{25}$), that should be much larger than the last level
+cache. For each kernel the program reports the best bandwidth over
+`NREP` runs, counting (as STREAM does) one read or write for each
+element of each array accessed; with streaming stores, this is also
+the actual traffic to memory.
+
+        Kernel        Best MB/s   Avg time   Min time   Max time
+        copy          ...
+
+`copy` is the reference: the other kernels should reach about the
+same bandwidth. `transpose_add` accesses the same three arrays as
+`add`, but reads one of them by columns; the last line of the output
+reports the ratio between their bandwidths.
+
+To compile:
+
+        gcc -std=c99 -Wall -Wpedantic -O2 -march=native -fopenmp simd-stream.c -o simd-stream
+
+To execute:
+
+        OMP_NUM_THREADS=P OMP_PROC_BIND=spread ./simd-stream [n]
+
+`OMP_PROC_BIND` keeps each thread on the same core, so that the data
+initialized by a thread stays on its NUMA node.
+
+## Files
+
+- [simd-stream.c](simd-stream.c)
+- [simd-kernels.h](simd-kernels.h)
+- [hpc.h](hpc.h)
+
+***/
+
+/* The following #define is required by posix_memalign() and MUST
+   appear before including any system header */
+#define _XOPEN_SOURCE 600
+
+#include "hpc.h"
+#include "simd-kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#define NREP 10
+
+enum { COPY, SCALE, ADD, AXPY, REVERSE, TRANSPOSE_ADD, NKERNELS };
+const char *kernel_name[] = {"copy", "scale", "add", "axpy", "reverse", "transpose_add"};
+/* number of arrays accessed by each kernel */
+const int kernel_arrays[] = {2, 2, 3, 3, 2, 3};
+
+/* Return nonzero iff a[i] == v for all i */
+int check_const( const float *a, float v, long n )
+{
+    for (long i=0; i<n; i++) {
+        if (a[i] != v) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main( int argc, char *argv[] )
+{
+    long n = 1L << 25;
+    double tmin[NKERNELS], tmax[NKERNELS], tsum[NKERNELS];
+    const float s = 3.0f;
+    int ok = 1;
+
+    if ( argc > 2 ) {
+        fprintf(stderr, "Usage: %s [n]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if ( argc > 1 ) {
+        n = atol(argv[1]);
+    }
+    assert(n > 0);
+
+    /* transpose_add works on the largest square matrix with at most
+       n elements */
+    const long m = (long)sqrt((double)n);
+
+    float *a = k_alloc(n), *b = k_alloc(n), *c = k_alloc(n);
+    k_first_touch(a, 1.0f, n);
+    k_first_touch(b, 2.0f, n);
+    k_first_touch(c, 0.0f, n);
+
+    for (int k=0; k<NKERNELS; k++) {
+        tmin[k] = 1e30; tmax[k] = tsum[k] = 0.0;
+    }
+
+    for (int r=0; r<NREP; r++) {
+        for (int k=0; k<NKERNELS; k++) {
+            const double tstart = hpc_gettime();
+            switch (k) {
+            case COPY: k_copy(c, a, n); break;
+            case SCALE: k_scale(c, a, s, n); break;
+            case ADD: k_add(c, a, b, n); break;
+            case AXPY: k_axpy(c, s, a, n); break;
+            case REVERSE: k_reverse(c, a, n); break;
+            case TRANSPOSE_ADD: k_transpose_add(c, a, b, m); break;
+            default: assert(0);
+            }
+            const double elapsed = hpc_gettime() - tstart;
+            /* The first run is a warm-up, as in STREAM */
+            if (r > 0) {
+                tsum[k] += elapsed;
+                tmin[k] = (elapsed < tmin[k] ? elapsed : tmin[k]);
+                tmax[k] = (elapsed > tmax[k] ? elapsed : tmax[k]);
+            }
+        }
+    }
+
+    /* Check the kernels once more on known data */
+    k_copy(c, a, n); ok = ok && check_const(c, 1.0f, n);
+    k_scale(c, a, s, n); ok = ok && check_const(c, s, n);
+    k_add(c, a, b, n); ok = ok && check_const(c, 3.0f, n);
+    k_axpy(c, s, a, n); ok = ok && check_const(c, 3.0f + s, n);
+    k_transpose_add(c, a, b, m); ok = ok && check_const(c, 3.0f, m*m);
+    for (long i=0; i<n; i++) {
+        a[i] = i;
+    }
+    k_reverse(c, a, n);
+    for (long i=0; i<n; i++) {
+        ok = ok && (c[i] == a[n - 1 - i]);
+    }
+    for (long i=0; i<m*m; i++) {
+        b[i] = (float)(i % 1000);
+    }
+    k_first_touch(a, 0.0f, n);
+    k_transpose_add(c, a, b, m);
+    for (long i=0; i<m; i++) {
+        for (long j=0; j<m; j++) {
+            ok = ok && (c[i*m + j] == b[j*m + i]);
+        }
+    }
+
+    printf("Threads: %d, n = %ld (%.1f MB per array), vector length = %ld floats\n",
+           omp_get_max_threads(), n, n * sizeof(float) / 1e6, VLEN);
+    printf("%-14s %12s %12s %12s %12s\n", "Kernel", "Best MB/s", "Avg time", "Min time", "Max time");
+    double mbs[NKERNELS];
+    for (int k=0; k<NKERNELS; k++) {
+        const long len = (k == TRANSPOSE_ADD ? m*m : n);
+        const double bytes = (double)kernel_arrays[k] * len * sizeof(float);
+        mbs[k] = 1e-6 * bytes / tmin[k];
+        printf("%-14s %12.1f %12.6f %12.6f %12.6f\n", kernel_name[k],
+               mbs[k], tsum[k] / (NREP - 1), tmin[k], tmax[k]);
+    }
+    printf("transpose_add / add: %.2f\n", mbs[TRANSPOSE_ADD] / mbs[ADD]);
+    printf("Check: %s\n", ok ? "OK" : "FAILED");
+
+    free(a);
+    free(b);
+    free(c);
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}